@@ -1,57 +1,153 @@
 #include<unordered_map>
-#include<unordered_set>
+#include <algorithm>
 #include <queue>
+#include <cstdio>
+#include <climits>
 #define OLC_PGE_APPLICATION
+#define OLC_TRACK_ALLOCATIONS
 #include "olcPixelGameEngine.h"
 
+// What the heap is used for, see olc::Allocations. Whatever is not
+// allocated inside an olc::AllocationScope counts towards the engine.
+enum MemoryTag : uint8_t {
+	MEM_ENGINE, MEM_ASSETS, MEM_NETWORK, MEM_PASSENGERS, MEM_TRAINS, MEM_BLOCKADES, MEM_TAG_COUNT
+};
+static const char* const memoryTagNames[MEM_TAG_COUNT] = {
+	"engine", "assets", "network", "passengers", "trains", "blockades" };
+
+// Live heap per tag and everything allocated so far, printed at exit
+void PrintMemoryUsage() {
+	if (!olc::Allocations::Enabled()) return;
+	printf("%-12s %12s %10s %14s %12s\n", "heap", "live bytes", "blocks", "allocated", "allocations");
+	for (int tag = 0; tag < MEM_TAG_COUNT; ++tag) {
+		olc::Allocations::Stats stats = olc::Allocations::Get(tag);
+		printf("%-12s %12lld %10lld %14lld %12lld\n", memoryTagNames[tag], (long long)stats.nLiveBytes,
+			(long long)stats.nLiveBlocks, (long long)stats.nTotalBytes, (long long)stats.nAllocations);
+	}
+}
+
 enum State {
-	boarding, readyToMove, waiting, moving, stopped
+	boarding, readyToMove, waiting, moving, stopped, retired
 };
 
 struct DevilishBlockade {
 	std::pair<int, int> pos;
-	olc::Decal* decal = new olc::Decal(new olc::Sprite("./Sprites/Blockade.png"));
+	bool defused = false;
 
 	DevilishBlockade(std::pair<int, int>& pos) : pos(pos) {}
 };
 
+// What the scans over all passengers every tick look at, kept small so
+// three fit in a cache line. The rest is in PassengerInfo at the same index.
 struct Passenger {
-	olc::Decal* decal = new olc::Decal(new olc::Sprite("./Sprites/Passenger.png"));
 	int id;
 	int timeToStartWorking;
-	std::pair<int, int> pos;
-	int origin;
-	int destination;
-	std::unordered_set<int> okLines;
-	int delayed = 0;
-	int needDirection = 0;
-
-	Passenger(int id = -1, int timeToStartWorking = 900, std::pair<int, int> pos = { 0,0 },
-		int origin = 0, int dest = 0, std::unordered_set<int> okLines = {}, int needDirection = 1) :
+	uint32_t lineMask = 0;	// Lines that ride the current leg
+	int16_t origin;			// Station waited at, -1 on a train, -2 arrived and the slot free
+	int16_t legTo = -1;		// Where the current leg ends
+	uint16_t delayed = 0;
+	uint8_t leg = 0;
+	int8_t legDirection = 0;
+
+	Passenger(int id = -1, int timeToStartWorking = 900, int origin = 0) :
 		id(id),
 		timeToStartWorking(timeToStartWorking),
-		pos(pos),
-		origin(origin),
-		destination(dest),
-		okLines(okLines),
-		needDirection(needDirection) {}
+		origin(origin) {}
+};
+static_assert(sizeof(Passenger) == 20, "Passenger is meant to stay this small");
+
+struct PassengerInfo {
+	int home;
+	int destination;
+	int journey = -1; // Index into JourneyPlanner::journeys
+	int train = -1;	// Ridden, only meaningful while on a train
+};
+
+// In aggregate demand mode commuters with the same journey, leg and
+// deadline are only counted. Otherwise they follow the same rules as
+// a Passenger.
+struct Cohort {
+	int journey;
+	int timeToStartWorking;
+	int count;
+	uint32_t lineMask = 0;
+	int16_t legTo = -1;
+	uint16_t delayed = 0;
+	uint8_t leg = 0;
+	int8_t legDirection = 0;
+};
+
+// FIFO of train ids in a buffer that is sized once for the number of
+// trains. A train is never queued twice on the same lane, so it can't fill up.
+struct TrainRing {
+	std::vector<int> slots;
+	int head = 0;
+	int count = 0;
+
+	// Makes room for more trains, the queued ones keep their order
+	void grow(int capacity) {
+		if (capacity <= (int)slots.size()) return;
+		std::vector<int> grown(capacity, -1);
+		for (int i = 0; i < count; ++i) {
+			grown[i] = slots[(head + i) % slots.size()];
+		}
+		slots.swap(grown);
+		head = 0;
+	}
+
+	bool empty() const { return count == 0; }
+	int size() const { return count; }
+	int front() const { return slots[head]; }
+
+	void push(int id) {
+		slots[(head + count) % slots.size()] = id;
+		++count;
+	}
+
+	void pop() {
+		head = (head + 1) % slots.size();
+		--count;
+	}
+
+	bool contains(int id) const {
+		for (int i = 0; i < count; ++i) {
+			if (slots[(head + i) % slots.size()] == id) return true;
+		}
+		return false;
+	}
 };
 
 struct Station {
-	olc::Decal* decal = new olc::Decal(new olc::Sprite("./Sprites/Station.png"));
 	int id = -1;
-	int width = 15;
-	int height = 15;
+	// Footprint of Sprites/Station.png, the lanes run along either side
+	int width = 30;
+	int height = 10;
 	float angle = 0.f;
 
 	std::pair<int, int> pos;
-	std::queue<int> queOnLane1;
-	std::queue<int> queOnLane2;
+	TrainRing queOnLane1;
+	TrainRing queOnLane2;
 	std::pair<int, int> occupiedLanes{ -1,-1 };
+	// Trains that may not leave for this station yet, parked per lane until
+	// the lane is freed or the head of its queue arrives
+	TrainRing waitOnLane1;
+	TrainRing waitOnLane2;
+	// Passengers waiting here, as indices into Graph::slaves in the order
+	// they came
+	std::vector<int> waitingPassengers;
+	std::vector<Cohort> waitingCohorts;
 
+	int cohortsLateAt = INT_MAX;	// Tick queued in Graph::lateCohorts
 
 	Station(int id, std::pair<int, int>& pos, float angle = 0.f) : id(id), pos(pos), angle(angle) {}
 
+	void reserveLanes(int nTrains) {
+		queOnLane1.grow(nTrains);
+		queOnLane2.grow(nTrains);
+		waitOnLane1.grow(nTrains);
+		waitOnLane2.grow(nTrains);
+	}
+
 	void registerTrain(int id, int direction) {
 		if (direction == 1) {
 			occupiedLanes.first = id;
@@ -61,12 +157,17 @@ struct Station {
 		}
 	}
 
-	void unregisterTrain(int direction) {
+	void parkTrain(int trainId, int direction) {
+		TrainRing& parked = parkedOn(direction);
+		if (!parked.contains(trainId)) parked.push(trainId);
+	}
+
+	TrainRing& parkedOn(int direction) {
 		if (direction == 1) {
-			occupiedLanes.first = -1;
+			return waitOnLane1;
 		}
 		else {
-			occupiedLanes.second = -1;
+			return waitOnLane2;
 		}
 	}
 
@@ -114,34 +215,76 @@ struct Station {
 		int x; int y;
 		if (direction < 0)
 		{
-			x = decal->sprite->width / 3;
-			y = 4 * decal->sprite->height / 2;
+			x = width / 3;
+			y = 4 * height / 2;
 		}
 		else
 		{
-			x = decal->sprite->width / 3;
-			y = (-2) * decal->sprite->height / 2;
+			x = width / 3;
+			y = (-2) * height / 2;
 		}
 		return std::pair<int, int>{ pos.first + cos(angle) * x - sin(angle) * y,
 			pos.second + sin(angle) * x + cos(angle) * y};
 	}
 };
 
+// Headway by time of day. Each period starts at a minute of the day and
+// lasts until the next one, the last runs on past midnight.
+struct Timetable {
+	std::vector<std::pair<int, int>> periods; // (first minute, headway in ticks)
+
+	int headwayAt(int minuteOfDay) const {
+		int headway = periods.back().second;
+		for (auto& [from, ticks] : periods) {
+			if (from <= minuteOfDay) headway = ticks;
+		}
+		return headway;
+	}
+};
+
+struct Line {
+	std::vector<int> stops;
+	std::vector<int> stopIndex; // By station, -1 where the line doesn't stop
+	Timetable timetable;
+	// Ticks for a round trip without blockades, which sets how many
+	// trains it takes to keep the headway
+	int cycleTicks = 0;
+
+	int fleetAt(int minuteOfDay) const {
+		int headway = timetable.headwayAt(minuteOfDay);
+		return std::max(1, (cycleTicks + headway - 1) / headway);
+	}
+};
+
 struct Train {
-	olc::Decal* decal = new olc::Decal(new olc::Sprite("./Sprites/SBahn.png"));
 	DevilishBlockade* blockade = nullptr;
 	float angle = 0.f;
 
 	int id;
-	std::vector<int> line;
-	int myLine = 0;
-	std::unordered_set<int> myPassengers;
+	int myLine = 0;	// Index into Graph::lines
+	// Passengers on board by the index of the stop their ride ends at, as
+	// indices into Graph::slaves, so a stop only touches who gets off there
+	std::vector<std::vector<int>> riders;
+	int riding = 0;
+	std::vector<Cohort> cohorts;
+	int load = 0; // Commuters in cohorts
+	int cohortsLateAt = INT_MAX;	// Tick queued in Graph::lateCohorts
 	std::pair<int, int> destination;
 	State state = readyToMove;
 	int idx = 0;
 	int direction = 1;
 	std::pair<int, int> pos;
 
+	// Scheduling state, while moving pos is only brought up to date lazily:
+	// it is the position at the start of moveTick and advances by step per tick
+	int wakeTick = -1;
+	int moveTick = 0;
+	std::pair<int, int> step{ 0,0 };
+	// Outcome of the compute phase, applied in the commit phase
+	bool planned = false;
+	bool arrived = false;
+	int plannedWake = -1;
+
 	Train() {}
 
 	Train(int id, std::pair<int, int>& pos, State state, int direction, int myLine) :
@@ -151,8 +294,8 @@ struct Train {
 		direction(direction),
 		myLine(myLine) {}
 
-	void updatePositionAndDirection() {
-		if ((idx == 0 && direction == -1) || (idx == line.size() - 1 && direction == 1)) {
+	void updatePositionAndDirection(const Line& line) {
+		if ((idx == 0 && direction == -1) || (idx == line.stops.size() - 1 && direction == 1)) {
 			direction *= -1;
 		}
 		else {
@@ -160,16 +303,22 @@ struct Train {
 		}
 	}
 
-	void updateDestination() {
-		if ((idx == 0 && direction == -1) || (idx == line.size() - 1 && direction == 1)) {
-			destination = std::pair<int, int>{ line[idx], -direction };
+	void updateDestination(const Line& line) {
+		if ((idx == 0 && direction == -1) || (idx == line.stops.size() - 1 && direction == 1)) {
+			destination = std::pair<int, int>{ line.stops[idx], -direction };
 		}
 		else
-			destination = std::pair<int, int>{ line[idx + direction], direction };
+			destination = std::pair<int, int>{ line.stops[idx + direction], direction };
+	}
+
+	// Just turned around at either end of the line
+	bool atTerminus(const Line& line) const {
+		return (idx == 0 && direction == 1) || (idx == line.stops.size() - 1 && direction == -1);
 	}
 
+	// A cleared blockade is forgotten by the train, which is then free to go
 	bool isBlocked(std::pair<int, int>& movementVector) {
-		return dist(addPair(pos, movementVector), blockade->pos) < 20;
+		return blockade && dist(addPair(pos, movementVector), blockade->pos) < 20;
 	}
 
 	std::pair<int, int> addPair(std::pair<int, int>& pos1, std::pair<int, int>& pos2) {
@@ -182,27 +331,390 @@ struct Train {
 	}
 };
 
+// One ride of a journey, any line in lineMask takes you from -> to
+struct Leg {
+	int from;
+	int to;
+	int direction;
+	uint32_t lineMask;
+};
+
+struct Journey {
+	std::vector<Leg> legs;
+	int stops = 0;
+};
+
+// RAPTOR over the fixed lines, run once for every origin when the network
+// is built. Spawning a passenger is then a lookup into the journey table.
+struct JourneyPlanner {
+	static constexpr int maxLegs = 4;
+	static constexpr int transferPenalty = 5; // in stops
+
+	int nStations = 0;
+	// Transfer table: which lines stop at a station and at which index
+	std::vector<std::vector<std::pair<int, int>>> linesAtStation;
+	std::vector<Journey> journeys;
+
+	void Build(const std::vector<Line>& lines, int stationCount) {
+		nStations = stationCount;
+		linesAtStation.assign(nStations, {});
+		for (int l = 0; l < lines.size(); ++l) {
+			for (int i = 0; i < lines[l].stops.size(); ++i) {
+				linesAtStation[lines[l].stops[i]].emplace_back(l, i);
+			}
+		}
+		journeys.assign(nStations * nStations, Journey());
+		for (int origin = 0; origin < nStations; ++origin) {
+			PlanFrom(origin, lines);
+		}
+	}
+
+	int Lookup(int origin, int destination) const {
+		return origin * nStations + destination;
+	}
+
+	// Lines that ride from -> to in the given direction
+	uint32_t LinesServing(int from, int to, int direction) const {
+		uint32_t mask = 0;
+		for (auto& [l, i] : linesAtStation[from]) {
+			for (auto& [m, j] : linesAtStation[to]) {
+				if (l == m && (j - i) * direction > 0) mask |= 1u << l;
+			}
+		}
+		return mask;
+	}
+
+	void PlanFrom(int origin, const std::vector<Line>& lines) {
+		struct Label { int stops = INT_MAX; int line = -1; int direction = 0; int boardedAt = -1; };
+		std::vector<std::vector<Label>> rounds(maxLegs + 1, std::vector<Label>(nStations));
+		rounds[0][origin].stops = 0;
+
+		for (int k = 1; k <= maxLegs; ++k) {
+			rounds[k] = rounds[k - 1];
+			for (auto& label : rounds[k]) label.line = -1;
+			bool improved = false;
+			for (int l = 0; l < lines.size(); ++l) {
+				for (int direction : { 1, -1 }) {
+					int n = lines[l].stops.size();
+					int boardedAt = -1;
+					int boardedStops = INT_MAX;
+					int begin = direction == 1 ? 0 : n - 1;
+					for (int i = begin, ride = 0; i >= 0 && i < n; i += direction, ++ride) {
+						int stop = lines[l].stops[i];
+						if (boardedAt != -1 && boardedStops + ride < rounds[k][stop].stops) {
+							rounds[k][stop] = { boardedStops + ride, l, direction, boardedAt };
+							improved = true;
+						}
+						// Hop on here if we arrived earlier in the previous round
+						if (rounds[k - 1][stop].stops != INT_MAX &&
+							(boardedAt == -1 || rounds[k - 1][stop].stops < boardedStops + ride)) {
+							boardedAt = stop;
+							boardedStops = rounds[k - 1][stop].stops - ride;
+						}
+					}
+				}
+			}
+			if (!improved) break;
+		}
+
+		for (int destination = 0; destination < nStations; ++destination) {
+			if (destination == origin) continue;
+			int best = -1;
+			int bestCost = INT_MAX;
+			for (int k = 1; k <= maxLegs; ++k) {
+				if (rounds[k][destination].line == -1) continue;
+				int cost = rounds[k][destination].stops + transferPenalty * (k - 1);
+				if (cost < bestCost) {
+					bestCost = cost;
+					best = k;
+				}
+			}
+			if (best == -1) continue;
+
+			Journey& journey = journeys[Lookup(origin, destination)];
+			journey.stops = rounds[best][destination].stops;
+			int stop = destination;
+			for (int k = best; k > 0; --k) {
+				const Label& label = rounds[k][stop];
+				if (label.line == -1) continue; // Already there in an earlier round
+				journey.legs.push_back({ label.boardedAt, stop, label.direction,
+					LinesServing(label.boardedAt, stop, label.direction) });
+				stop = label.boardedAt;
+			}
+			std::reverse(journey.legs.begin(), journey.legs.end());
+		}
+	}
+};
+
+// Random numbers for the demand model. It has its own generator instead
+// of rand() so that a seed draws the same commuters with any C library.
+struct DemandRng {
+	uint64_t state = 0;
+
+	DemandRng(uint64_t seed = 0) : state(seed) {}
+
+	// SplitMix64
+	uint64_t Next() {
+		uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	// In [0, 1)
+	double Uniform() {
+		return (Next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	// Knuth's product of uniforms for small means. Above that Hörmann's
+	// transformed rejection (PTRS), which needs about one try whatever
+	// the mean, so a rush hour costs no more than a quiet night.
+	int Poisson(double mean) {
+		if (mean <= 0.0) return 0;
+		if (mean < 30.0) {
+			double limit = exp(-mean);
+			double product = Uniform();
+			int k = 0;
+			while (product > limit) {
+				product *= Uniform();
+				++k;
+			}
+			return k;
+		}
+		double root = sqrt(mean);
+		double logMean = log(mean);
+		double b = 0.931 + 2.53 * root;
+		double a = -0.059 + 0.02483 * b;
+		double invAlpha = 1.1239 + 1.1328 / (b - 3.4);
+		double vr = 0.9277 - 3.6224 / (b - 2.0);
+		while (true) {
+			double u = Uniform() - 0.5;
+			double v = Uniform();
+			double us = 0.5 - fabs(u);
+			int k = (int)floor((2.0 * a / us + b) * u + mean + 0.43);
+			if (us >= 0.07 && v <= vr) return k;
+			if (k < 0 || (us < 0.013 && v > us)) continue;
+			if (log(v) + log(invAlpha) - log(a / (us * us) + b) <= -mean + k * logMean - lgamma(k + 1.0)) return k;
+		}
+	}
+};
+
+// Walker's alias method. Building takes O(n), after that one uniform
+// number picks an outcome with the probability of its weight: it selects
+// a slot, and the slot's threshold decides between it and its alias.
+struct AliasTable {
+	struct Slot {
+		float threshold = 1.f;
+		int alias = 0;
+	};
+	std::vector<Slot> slots;
+
+	void Build(const std::vector<double>& weights) {
+		int n = weights.size();
+		slots.assign(n, Slot());
+		double total = 0.0;
+		for (double weight : weights) total += weight;
+		std::vector<double> scaled(n);
+		std::vector<int> small, large;
+		for (int i = 0; i < n; ++i) {
+			scaled[i] = total > 0.0 ? weights[i] * n / total : 1.0;
+			slots[i].alias = i;
+			(scaled[i] < 1.0 ? small : large).push_back(i);
+		}
+		// Every short slot is topped up from a tall one until all are full
+		while (!small.empty() && !large.empty()) {
+			int s = small.back();
+			small.pop_back();
+			int l = large.back();
+			slots[s].threshold = (float)scaled[s];
+			slots[s].alias = l;
+			scaled[l] -= 1.0 - scaled[s];
+			if (scaled[l] < 1.0) {
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+	}
+
+	// u in [0, 1)
+	int Sample(double u) const {
+		double x = u * slots.size();
+		int i = std::min((int)x, (int)slots.size() - 1);
+		return x - i < slots[i].threshold ? i : slots[i].alias;
+	}
+};
+
+// Where and when commuters turn up. Every connected pair of stations has
+// a weight. Mornings draw the pairs from home to work, evenings the same
+// pairs the other way around, each direction following its own curve
+// through the day. The number of commuters arriving within some ticks is
+// Poisson distributed and each one's pair is one draw from an alias
+// table, so a spawn costs the same however many stations there are.
+struct DemandModel {
+	std::vector<int> pairs;	// Index into JourneyPlanner::journeys
+	AliasTable toWork;
+	AliasTable toHome;		// Same pairs, weighted by the reverse pair
+	double peakPerHour = 0.0;
+	DemandRng rng;
+
+	// Share of the peak by hour of the day in permille, the two together
+	// reach 1000 in the morning rush
+	static int toWorkProfile(int hour) {
+		static const int profile[24] = {
+			10, 5, 5, 5, 25, 130, 450, 900, 850, 450, 150, 100,
+			100, 100, 80, 80, 80, 60, 50, 30, 20, 20, 20, 20 };
+		return profile[hour];
+	}
+
+	static int toHomeProfile(int hour) {
+		static const int profile[24] = {
+			10, 5, 5, 5, 5, 20, 50, 100, 150, 150, 150, 200,
+			250, 250, 220, 320, 620, 840, 650, 370, 230, 130, 80, 30 };
+		return profile[hour];
+	}
+
+	// weights holds one weight per journey, laid out like
+	// JourneyPlanner::journeys, 0 for pairs nobody travels between
+	void Build(const std::vector<int>& weights, int nStations) {
+		pairs.clear();
+		std::vector<double> forward, backward;
+		for (int od = 0; od < weights.size(); ++od) {
+			if (!weights[od]) continue;
+			pairs.push_back(od);
+			forward.push_back(weights[od]);
+			backward.push_back(weights[(od % nStations) * nStations + od / nStations]);
+		}
+		toWork.Build(forward);
+		toHome.Build(backward);
+	}
+
+	// Calls spawn(k) for every commuter arriving within the next ticks,
+	// k being the index of the commuter's pair in pairs. The hour of day
+	// is the one the ticks start in, so callers keep them short.
+	template<typename F>
+	int Draw(int minuteOfDay, int ticks, int ticksPerHour, F&& spawn) {
+		if (pairs.empty()) return 0;
+		int hour = minuteOfDay / 60;
+		int work = toWorkProfile(hour);
+		int home = toHomeProfile(hour);
+		int count = rng.Poisson(peakPerHour * (work + home) / 1000.0 * ticks / ticksPerHour);
+		// One uniform picks the direction and, rescaled, the pair
+		double homeShare = double(home) / (work + home);
+		for (int i = 0; i < count; ++i) {
+			double u = rng.Uniform();
+			if (u < homeShare) spawn(toHome.Sample(u / homeShare));
+			else spawn(toWork.Sample((u - homeShare) / (1.0 - homeShare)));
+		}
+		return count;
+	}
+};
+
+// Ticks commuters have been late, summed up by where they spent them:
+// waiting at or standing in a station, or on a train between two. Both
+// directions of a stretch of track share one segment. Every addition is
+// O(1) and the largest sums are kept up to date, so the overlay scales
+// its colours without a pass over everything.
+struct DelayHeatmap {
+	std::vector<int64_t> stations;
+	std::vector<int64_t> segments;
+	std::vector<std::pair<int, int>> segmentEnds;	// Stations, lower id first
+	std::vector<int> segmentOf;	// By pair of stations, -1 without track between them
+	int nStations = 0;
+	int64_t maxStation = 0;
+	int64_t maxSegment = 0;
+	int version = 0;	// Bumped with every addition
+
+	void Build(const std::vector<Line>& lines, int n) {
+		nStations = n;
+		stations.assign(n, 0);
+		segmentOf.assign(n * n, -1);
+		for (auto& line : lines) {
+			for (int i = 1; i < line.stops.size(); ++i) {
+				int a = std::min(line.stops[i - 1], line.stops[i]);
+				int b = std::max(line.stops[i - 1], line.stops[i]);
+				if (segmentOf[a * n + b] != -1) continue;
+				segmentOf[a * n + b] = segmentOf[b * n + a] = segmentEnds.size();
+				segmentEnds.emplace_back(a, b);
+			}
+		}
+		segments.assign(segmentEnds.size(), 0);
+	}
+
+	void atStation(int station, int ticks) {
+		stations[station] += ticks;
+		maxStation = std::max(maxStation, stations[station]);
+		++version;
+	}
+
+	void between(int from, int to, int ticks) {
+		int segment = segmentOf[from * nStations + to];
+		segments[segment] += ticks;
+		maxSegment = std::max(maxSegment, segments[segment]);
+		++version;
+	}
+};
+
 struct Graph {
 	int commuteTime = 80;
 	int globalTime = 0;
-	int score = 0;
+	int64_t score = 0;	// Grows by whole cohorts in aggregate mode
 	std::vector<Train> trains;
-	std::vector<DevilishBlockade*> devilishBlockade;
+	std::vector<std::unique_ptr<DevilishBlockade>> devilishBlockade;
 	std::vector<Passenger> slaves;
+	std::vector<PassengerInfo> slaveInfo;	// Same index as slaves
+	// Slots of arrived passengers, reused before the vectors grow so that
+	// the indices held by stations and trains stay valid
+	std::vector<int> freeSlaves;
+	DemandModel demand;
+	int nextPassengerId = 0;
+	int delivered = 0;	// Commuters that got where they were going
+	DelayHeatmap delays;
+	// Peak commuters per hour when nothing else is asked for
+	static constexpr int individualPeakPerHour = 120;
+	// In aggregate demand mode commuters arrive in buckets and are counted
+	// per journey before they become cohorts
+	bool cohortDemand = false;
+	std::vector<int> drawnPerPair;	// Same index as demand.pairs
+	static constexpr int cohortBucket = 100;	// Ticks between arrivals
+	static constexpr int ticksPerHour = 600;
+	static constexpr int trainCapacity = 1500;
 	std::vector<Station> stations;
 	std::vector<std::pair<int, int>> nodes;
 	std::vector<std::vector<int>> adjacencyList;
-	std::vector<std::vector<int>> lines;
+	// Built with the network and never changed afterwards, trains only
+	// keep the index of their line
+	std::vector<Line> lines;
+	// Dispatcher state per line
+	struct LineService {
+		int fleet = 0;	// Trains in service
+		int nextDispatch = 0;
+		int nextEnd = 0;
+	};
+	std::vector<LineService> services;
+	// Slots of retired trains, reused before the vector grows
+	std::vector<int> freeTrainIds;
+	int laneCapacity = 0;
+	static constexpr int ticksPerStop = 12;
+	JourneyPlanner planner;
 	int stepsize = 10;
+	// Pending (tick, train id) events, earliest first
+	std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<>> events;
+	// Pending (tick, passenger slot) for when a commuter is late next, and
+	// (tick, holder) for the earliest such tick among the cohorts of a
+	// station or train. Holders are station ids, then stations.size() plus
+	// a train id. Entries that no longer match are skipped.
+	std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<>> lateSlaves;
+	std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<>> lateCohorts;
+	std::vector<int> dueTrains;
+	// Worker pool for the compute phase, updates run serially without one
+	olc::JobSystem* jobs = nullptr;
+	// Below this many trains per tick threads cost more than they save
+	static constexpr int minParallelTrains = 64;
 
 	Graph() {}
 
 	// Initialize graph of stations and trains and everything
 	Graph(int width, int height) {
-		std::pair<int, int> dummy{ width, height };
-		for (int id = 0; id < 10;++id) {
-			trains.push_back(Train(id, dummy, boarding, 1, id % 5));
-		}
 		int x = width / 2;
 		int y = height / 2;
 		int spacing = 40;
@@ -243,524 +755,2170 @@ struct Graph {
 			nodes.emplace_back(x + (3 + lambda) * spacing, y - lambda * spacing);
 			stations.emplace_back(50 + lambda, nodes.back(), 7.f * 3.141f / 4.f);
 		}
-		// Add Lines to trains
-		trains[0].line = std::vector<int>{ 42,41,40,19,5,6,7,8,9,10,11,12,13,14,15,35,36,37,38,39 };
-		trains[1].line = std::vector<int>{ 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18 };
-		trains[2].line = std::vector<int>{ 47,46,45,44,43,5,6,7,8,9,10,11,12,13,14,15,51,52,53 };
-		trains[3].line = std::vector<int>{ 24,23,22,21,20,19,5,6,7,8,9,10,11,12,13,14,15,34,33,32,31 };
-		trains[4].line = std::vector<int>{ 30,29,28,27,26,25,8,9,10,11,12,13,14,15,34,48,49,50 };
-		for (int i = 5; i < 10; ++i) {
-			trains[i].line = trains[i - 5].line;
+		// Lines and their timetable, minutes of the day with headways in
+		// ticks. A game minute is ten ticks.
+		Timetable timetable;
+		timetable.periods = {
+			{ 0 * 60, 480 },	// Night
+			{ 5 * 60, 240 },
+			{ 7 * 60, 120 },	// Morning rush
+			{ 9 * 60 + 30, 240 },
+			{ 16 * 60, 120 },	// Evening rush
+			{ 19 * 60, 300 },
+		};
+		for (auto& stops : std::vector<std::vector<int>>{
+			{ 42,41,40,19,5,6,7,8,9,10,11,12,13,14,15,35,36,37,38,39 },
+			{ 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18 },
+			{ 47,46,45,44,43,5,6,7,8,9,10,11,12,13,14,15,51,52,53 },
+			{ 24,23,22,21,20,19,5,6,7,8,9,10,11,12,13,14,15,34,33,32,31 },
+			{ 30,29,28,27,26,25,8,9,10,11,12,13,14,15,34,48,49,50 } }) {
+			Line line;
+			line.stops = stops;
+			line.stopIndex.assign(stations.size(), -1);
+			for (int i = 0; i < stops.size(); ++i) {
+				line.stopIndex[stops[i]] = i;
+			}
+			line.timetable = timetable;
+			line.cycleTicks = 2 * ((int)stops.size() - 1) * ticksPerStop;
+			lines.push_back(line);
 		}
+		services.assign(lines.size(), LineService());
+		planner.Build(lines, stations.size());
+		delays.Build(lines, stations.size());
+	}
 
-		for (int i = 0; i < 5; ++i) {
-			lines.push_back(trains[i].line);
-			trains[i].pos = stations[trains[i].line[0]].lanePosition(1);
-			trains[i].idx = 0;
-			trains[i + 5].pos = stations[trains[i + 5].line.back()].lanePosition(1);
-			trains[i + 5].idx = lines[i].size() - 1;
-		}
+	const Line& lineOf(const Train& train) const {
+		return lines[train.myLine];
 	}
 
-	void handleTrains() {
-		++globalTime;
-		if (globalTime > 1e9) globalTime = 0;
-		for (auto& train : trains) {
-			if (train.state == readyToMove) {
-				train.updateDestination();
-				train.state = moving;
-			}
-			else if (train.state == moving) {
-				findClosestBlockade(train);
-				moveTrain(train);
-			}
-			else if (train.state == boarding) {
-				train.updateDestination();
-				stations[train.destination.first].addIncomingTrain(train.id, train.destination.second);
-				boardPassengers(train);
-				train.state = waiting;
-			}
-			else if (train.state == waiting) {
-				int nextId = stations[train.destination.first].nextInLine(train.direction);
-				if ((train.id == nextId || nextId == -1) &&
-					stations[train.destination.first].isLaneAvailable(train.destination.second)) {
-					train.state = readyToMove;
+	// Late commuters on a train count towards the station it stands in
+	// or the track it is on
+	void lateOnTrain(const Train& train, int commuters) {
+		int here = lineOf(train).stops[train.idx];
+		if (train.state == moving || train.state == stopped) delays.between(here, train.destination.first, commuters);
+		else delays.atStation(here, commuters);
+	}
+
+	// Commuters are late once the tick is more than 10 past their
+	// timeToStartWorking, which is then moved up to that tick
+	static int lateTick(int timeToStartWorking) {
+		return timeToStartWorking + 11;
+	}
+
+	// Has to be called whenever a passenger's timeToStartWorking changes
+	void watchSlave(int i) {
+		lateSlaves.emplace(lateTick(slaves[i].timeToStartWorking), i);
+	}
+
+	std::vector<Cohort>& cohortsOf(int holder) {
+		return holder < stations.size() ? stations[holder].waitingCohorts : trains[holder - stations.size()].cohorts;
+	}
+
+	int& cohortsLateAt(int holder) {
+		return holder < stations.size() ? stations[holder].cohortsLateAt : trains[holder - stations.size()].cohortsLateAt;
+	}
+
+	// Has to be called whenever a cohort is added to a station or train or
+	// its timeToStartWorking changes
+	void watchCohort(int holder, int timeToStartWorking) {
+		int tick = lateTick(timeToStartWorking);
+		int& due = cohortsLateAt(holder);
+		if (due <= tick) return;
+		due = tick;
+		lateCohorts.emplace(tick, holder);
+	}
+
+	int minuteOfDay() const {
+		return (6 * 60 + globalTime / 10) % (24 * 60);
+	}
+
+	// Lines short of the trains their timetable asks for get one more,
+	// at most one every half headway, from alternating ends. Surplus
+	// trains are retired when they reach either end.
+	void dispatchTrains() {
+		for (int l = 0; l < lines.size(); ++l) {
+			LineService& service = services[l];
+			if (service.fleet >= lines[l].fleetAt(minuteOfDay()) || globalTime < service.nextDispatch) continue;
+			for (int attempt = 0; attempt < 2; ++attempt) {
+				int end = service.nextEnd;
+				service.nextEnd ^= 1;
+				if (dispatchTrain(l, end)) {
+					service.nextDispatch = globalTime + lines[l].timetable.headwayAt(minuteOfDay()) / 2;
+					break;
 				}
 			}
-			else if (train.state == stopped) {
-				std::pair<int, int> target = stations[train.destination.first].lanePosition(train.destination.second);
-				std::pair<int, int> origin = stations[train.line[train.idx]].lanePosition(train.direction);
-				std::pair<int, int> movementVector = { (target.first - origin.first) / stepsize,(target.second - origin.second) / stepsize };
-				if (!train.isBlocked(movementVector))
-					train.state = moving;
-			}
 		}
 	}
 
-	void findClosestBlockade(Train& train) {
-		train.blockade = nullptr;
-		for (auto& blockade : devilishBlockade) {
-			if (dist(train.pos, blockade->pos) < 30) {
-				train.blockade = blockade;
-				break;
+	// The new train starts out as if it had just turned around at that
+	// end, which is only safe while no other train is there or on its way
+	bool dispatchTrain(int l, int end) {
+		const Line& line = lines[l];
+		int idx = end == 0 ? 0 : line.stops.size() - 1;
+		int direction = end == 0 ? 1 : -1;
+		Station& station = stations[line.stops[idx]];
+		for (int lane : { 1, -1 }) {
+			if (!station.isLaneAvailable(lane) || station.nextInLine(lane) != -1) return false;
+		}
+
+		int id;
+		if (freeTrainIds.empty()) {
+			id = trains.size();
+			trains.emplace_back();
+			if (id >= laneCapacity) {
+				laneCapacity = std::max(16, 2 * laneCapacity);
+				for (auto& s : stations) {
+					s.reserveLanes(laneCapacity);
+				}
 			}
 		}
-		train.state = (train.blockade == nullptr ? moving : stopped);
+		else {
+			id = freeTrainIds.back();
+			freeTrainIds.pop_back();
+		}
+		std::pair<int, int> pos = station.lanePosition(direction);
+		Train& train = trains[id];
+		train = Train(id, pos, boarding, direction, l);
+		train.riders.resize(line.stops.size());
+		train.idx = idx;
+		train.angle = station.angle;
+		station.registerTrain(id, -direction);
+		++services[l].fleet;
+		wakeAt(train, globalTime + 1);
+		return true;
 	}
 
-	void moveTrain(Train& train) {
-		std::pair<int, int> target = stations[train.destination.first].lanePosition(train.destination.second);
-		std::pair<int, int> origin = stations[train.line[train.idx]].lanePosition(train.direction);
+	// Everybody still on board gets off here, which at the end of the line
+	// is where all their rides end
+	void retireTrain(Train& train) {
+		boardPassengers(train, false);
+		unregisterTrain(lineOf(train).stops[train.idx], laneOf(train), train.id);
+		train.state = retired;
+		train.blockade = nullptr;
+		train.wakeTick = -1;
+		--services[train.myLine].fleet;
+		freeTrainIds.push_back(train.id);
+	}
 
-		addPair(train.pos, { (target.first - origin.first) / stepsize, (target.second - origin.second) / stepsize });
+	// Only trains with an event due this tick are looked at, in two phases.
+	// The compute phase works out in parallel what every due train does on
+	// its own: moving on, running into a blockade, arriving. The commit
+	// phase then pops the trains in (tick, id) order, which is the order
+	// they used to be polled in, and applies everything that touches
+	// stations, passengers or other trains. The outcome is the same as
+	// updating every train one after the other.
+	void handleTrains() {
+		olc::AllocationScope scope(MEM_TRAINS);
+		++globalTime;
+		if (globalTime > 1e9) globalTime = 0;
 
-		if (dist(train.pos, target) < 10) {
-			train.pos = target;
-			train.angle = stations[train.destination.first].angle;
+		dueTrains.clear();
+		while (!events.empty() && events.top().first <= globalTime) {
+			auto [tick, id] = events.top();
+			events.pop();
+			if (trains[id].wakeTick != tick) continue; // Rescheduled since
+			if (dueTrains.empty() || dueTrains.back() != id) dueTrains.push_back(id);
+		}
+
+		parallelFor(dueTrains.size(), [&](int i) {
+			planTrain(trains[dueTrains[i]]);
+		});
+
+		for (int id : dueTrains) {
+			events.emplace(globalTime, id);
+		}
+		while (!events.empty() && events.top().first <= globalTime) {
+			auto [tick, id] = events.top();
+			events.pop();
+			Train& train = trains[id];
+			if (train.wakeTick != tick) continue;
+			train.wakeTick = -1;
+			commitTrain(train);
+		}
+		dispatchTrains();
+	}
 
-			if (train.idx == 0 || train.idx == train.line.size() - 1) {
-				stations[train.line[train.idx]].occupiedLanes = std::pair<int, int>{ -1,-1 };
+	// Compute phase: writes only to the train itself and reads the network
+	// and the blockades, neither of which change during handleTrains
+	void planTrain(Train& train) {
+		train.planned = true;
+		train.arrived = false;
+		if (train.state == readyToMove) {
+			train.updateDestination(lineOf(train));
+			train.state = moving;
+			planSegment(train);
+		}
+		else if (train.state == moving) {
+			syncTrain(train, globalTime - 1);
+			findClosestBlockade(train);
+			moveTrain(train);
+			if (train.arrived || train.state == stopped) {
+				train.plannedWake = globalTime + 1;
 			}
 			else {
-				stations[train.line[train.idx]].unregisterTrain(train.direction);
+				planSegment(train);
 			}
-			stations[train.destination.first].removeIncomingTrain(train.id, train.destination.second);
-			stations[train.destination.first].registerTrain(train.id, train.direction);
-			train.updatePositionAndDirection();
-			train.state = boarding;
 		}
-	}
-
-	void boardPassengers(Train& train) {
-		int currentStationId = stations[train.line[train.idx]].id;
-		for (auto& slave : slaves)
-		{
-			// Board slave
-			if (!train.myPassengers.count(slave.id) &&
-				slave.origin == currentStationId &&
-				slave.needDirection == train.direction &&
-				slave.okLines.size() &&
-				slave.okLines.count(train.myLine))
-			{
-				train.myPassengers.insert(slave.id);
-				slave.timeToStartWorking += globalTime;
-				slave.origin = -1;
-				delete slave.decal;
-				slave.decal = nullptr;
-				slave.pos = { 0,0 };
+		else if (train.state == stopped) {
+			std::pair<int, int> movementVector = movementVectorOf(train);
+			if (!train.isBlocked(movementVector)) {
+				train.state = moving;
+				planSegment(train);
 			}
-
-			// Unboard Slave
-			if (slave.destination == currentStationId && train.myPassengers.count(slave.id)) {
-				train.myPassengers.erase(slave.id);
-				slave.origin = -2;
+			else {
+				// We stay put until a blockade is moved or cleared
+				train.plannedWake = -1;
 			}
 		}
-		slaves.erase(
-			std::remove_if(slaves.begin(), slaves.end(), [](auto& slave) {return slave.origin == -2;}),
-			slaves.end()
-		);
+		else {
+			train.planned = false;
+		}
 	}
 
-	void generateSlaves() {
-		if (slaves.size() < 80) {
-			int currentSize = slaves.size();
-			for (int i = 0; i < 20; ++i) {
-				int whichLine = rand() % 5;
-				int start = rand() % trains[whichLine].line.size();
-				int end = start;
-				while (end == start) {
-					end = rand() % trains[whichLine].line.size();
+	// Commit phase, one train at a time in id order
+	void commitTrain(Train& train) {
+		if (!train.planned) {
+			planTrain(train);
+		}
+		if (train.planned) {
+			train.planned = false;
+			if (train.arrived) {
+				arriveAtStation(train);
+			}
+			rescheduleAt(train, train.plannedWake);
+		}
+		else if (train.state == boarding) {
+			const Line& line = lineOf(train);
+			if (train.atTerminus(line) && services[train.myLine].fleet > line.fleetAt(minuteOfDay())) {
+				retireTrain(train);
+				return;
+			}
+			train.updateDestination(line);
+			stations[train.destination.first].addIncomingTrain(train.id, train.destination.second);
+			boardPassengers(train);
+			train.state = waiting;
+			wakeAt(train, globalTime + 1);
+		}
+		else if (train.state == waiting) {
+			if (mayLeave(train)) {
+				train.state = readyToMove;
+				wakeAt(train, globalTime + 1);
+			}
+			else {
+				// Park on the lane we need and on the queue we wait in,
+				// only those two can let us go
+				Station& station = stations[train.destination.first];
+				station.parkTrain(train.id, train.destination.second);
+				if (train.direction != train.destination.second) {
+					station.parkTrain(train.id, train.direction);
 				}
+			}
+		}
+	}
 
-				int originId = trains[whichLine].line[start];
-				int destinationId = trains[whichLine].line[end];
+	// Runs f(0) .. f(n - 1), spread over the engine's workers once there
+	// are enough trains for it to pay off
+	template<typename F>
+	void parallelFor(int n, F&& f) {
+		if (jobs == nullptr || n < minParallelTrains) {
+			for (int i = 0; i < n; ++i) f(i);
+			return;
+		}
+		jobs->ParallelFor(n, f, minParallelTrains / 4);
+	}
 
-				std::unordered_set<int> okLines;
-				for (int i = 0; i < lines.size(); ++i) {
-					auto line = lines[i];
-					if (std::find(line.begin(), line.end(), originId) != line.end() &&
-						std::find(line.begin(), line.end(), destinationId) != line.end()) {
-						okLines.insert(i);
-					}
-				}
+	std::pair<int, int> movementVectorOf(Train& train) {
+		std::pair<int, int> target = stations[train.destination.first].lanePosition(train.destination.second);
+		std::pair<int, int> origin = stations[lineOf(train).stops[train.idx]].lanePosition(train.direction);
+		return { (target.first - origin.first) / stepsize,(target.second - origin.second) / stepsize };
+	}
 
-				int direction = (start < end ? 1 : -1);
+	// The train moves from the next tick on. Look ahead along the segment
+	// for the first tick on which it either reaches a blockade or arrives,
+	// and sleep until then.
+	void planSegment(Train& train) {
+		train.moveTick = globalTime + 1;
+		train.step = movementVectorOf(train);
+		train.plannedWake = nextSegmentEvent(train);
+	}
 
-				// Make sure there are no collisions with ids!!
-				slaves.emplace_back(globalTime + i, globalTime + 10 * (100 + abs(start - end)),
-					stations[originId].pos, originId, destinationId,
-					okLines, direction);
+	int nextSegmentEvent(Train& train) {
+		std::pair<int, int> target = stations[train.destination.first].lanePosition(train.destination.second);
+		std::pair<int, int> pos = train.pos;
+		int lastDist = INT_MAX;
+		bool canArrive = true;
+		// A segment takes about stepsize ticks. Should a train overshoot its
+		// target it keeps going forever, and we only look for blockades until
+		// it is far off screen.
+		for (int j = 0; j < 100 * stepsize; ++j) {
+			for (auto& blockade : devilishBlockade) {
+				if (dist(pos, blockade->pos) < 30) {
+					return train.moveTick + j;
+				}
+			}
+			addPair(pos, train.step);
+			int d = dist(pos, target);
+			if (canArrive && d < 10) {
+				return train.moveTick + j;
 			}
+			// The distance is convex along the segment, once it grows we missed
+			canArrive = canArrive && d <= lastDist;
+			lastDist = d;
+			if (!canArrive && devilishBlockade.empty()) break;
 		}
+		return -1;
 	}
 
-	void addPair(std::pair<int, int>& pos1, const std::pair<int, int>& pos2) {
-		pos1.first += pos2.first;
-		pos1.second += pos2.second;
+	// Position of a moving train after the given tick has been processed
+	std::pair<int, int> positionAt(const Train& train, int tick) const {
+		if (train.state != moving || tick < train.moveTick) return train.pos;
+		int ticks = tick - train.moveTick + 1;
+		return { train.pos.first + ticks * train.step.first, train.pos.second + ticks * train.step.second };
 	}
 
-	void substractPair(std::pair<int, int>& pos1, const std::pair<int, int>& pos2) {
-		pos1.first -= pos2.first;
-		pos1.second -= pos2.second;
+	std::pair<int, int> trainPosition(const Train& train) const {
+		return positionAt(train, globalTime);
 	}
 
-	std::string convertGameTime() {
-		int time = globalTime / 10;
-
-		int hours = (6 + time / 60) % 24;
-		int minutes = time - 60 * (time / 60);
-		std::string mins = minutes < 10 ? "0" + std::to_string(minutes) : std::to_string(minutes);
-		return std::to_string(hours) + ":" + mins;
+	// Catch a lazily moving train up with everything processed until tick
+	void syncTrain(Train& train, int tick) {
+		if (train.state != moving || tick < train.moveTick) return;
+		train.pos = positionAt(train, tick);
+		train.moveTick = tick + 1;
+		train.blockade = nullptr;
 	}
 
-	int dist(std::pair<int, int>& pos1, std::pair<int, int>& pos2) {
-		return abs(pos1.first - pos2.first) + abs(pos1.second - pos2.second);
+	void syncTrains() {
+		for (auto& train : trains) syncTrain(train, globalTime);
 	}
-};
-
-struct Deifi {
-	std::pair<int, int> pos;
-	int nBombs;
 
-	olc::Sprite* sprite;
-	olc::Decal* decal;
-};
+	// Has to be called whenever blockades are added, moved or removed
+	// between two ticks
+	void blockadesChanged() {
+		parallelFor(trains.size(), [&](int i) {
+			if (trains[i].state == moving) {
+				syncTrain(trains[i], globalTime);
+				trains[i].plannedWake = nextSegmentEvent(trains[i]);
+			}
+		});
+		for (auto& train : trains) {
+			if (train.state == moving) {
+				rescheduleAt(train, train.plannedWake);
+			}
+			else if (train.state == stopped) {
+				wakeAt(train, globalTime + 1);
+			}
+		}
+	}
 
-struct Engel {
-	olc::Sprite* sprite;
-	olc::Decal* decal;
-	int id;
-	int removeTime = 20;
-	int stepsize = 30;
-	std::pair<int, int> pos;
-	std::pair<int, int> oldPos;
-	std::vector<std::pair<int, int>> queueOfDetonations;
-	std::vector<std::pair<int, int>> path;
+	bool mayLeave(Train& train) {
+		int nextId = stations[train.destination.first].nextInLine(train.direction);
+		return (train.id == nextId || nextId == -1) &&
+			stations[train.destination.first].isLaneAvailable(train.destination.second);
+	}
 
-	bool removeBlockade() {
-		--removeTime;
-		if (!removeTime) {
-			removeTime = 20;
-			return true;
-		}
-		return false;
+	// Lane the train holds at the stop it is at: the one it came in on, or
+	// at either end of its line the outer lane, which it keeps while turning
+	int laneOf(const Train& train) const {
+		if (train.idx == 0) return -1;
+		if (train.idx == lineOf(train).stops.size() - 1) return 1;
+		return train.direction;
 	}
 
-	bool Move() {
-		if (queueOfDetonations.size()) {
-			if (!path.size() && pos != queueOfDetonations[0]) {
-				generatePath();
-			}
-			else if (path.size()) {
-				pos = path.back();
-				path.pop_back();
+	// Frees the lane and wakes whoever was parked waiting for it. Lanes are
+	// only ever freed here so that no parked train is forgotten.
+	void unregisterTrain(int stationId, int direction, int currentTrain) {
+		std::pair<int, int>& lanes = stations[stationId].occupiedLanes;
+		(direction == 1 ? lanes.first : lanes.second) = -1;
+		laneChanged(stationId, direction, currentTrain);
+	}
 
-				if (!path.size()) {
-					return true;
-				}
-				if (pos.first < 10 || pos.first >  900 ||
-					pos.second < 10 || pos.second > 900) {
-					oldPos = pos;
-					return true;
-				}
+	// A lane was freed or the head of its queue arrived. Wake the parked
+	// trains that may leave now, trains after the current one still get to
+	// go in this tick. Taking a lane or joining a queue never lets anybody
+	// else go, so those don't wake anyone.
+	void laneChanged(int stationId, int direction, int currentTrain) {
+		TrainRing& parked = stations[stationId].parkedOn(direction);
+		for (int n = parked.size(); n > 0; --n) {
+			int id = parked.front();
+			parked.pop();
+			Train& train = trains[id];
+			if (train.state != waiting || train.destination.first != stationId) continue; // Left already
+			if (mayLeave(train)) {
+				wakeAt(train, id > currentTrain ? globalTime : globalTime + 1);
 			}
 			else {
-				return true;
+				parked.push(id);
 			}
 		}
-		return false;
 	}
 
-	void generatePath() {
-		int approxDist = dist(pos, queueOfDetonations[0]);
-		if (approxDist < 100) {
-			stepsize = 10;
-		}
-		else {
-			stepsize = 30;
-		}
-		int delX = (queueOfDetonations[0].first - pos.first) / stepsize;
-		int delY = (queueOfDetonations[0].second - pos.second) / stepsize;
-
-		for (int i = 1; i <= stepsize; ++i) {
-			path.emplace_back(pos.first + i * delX, pos.second + i * delY);
-		}
-		path.emplace_back(queueOfDetonations[0]);
-		std::reverse(path.begin(), path.end());
+	void wakeAt(Train& train, int tick) {
+		if (train.wakeTick != -1 && train.wakeTick <= tick) return;
+		rescheduleAt(train, tick);
 	}
 
-	void eraseFirstDetonation() {
-		if (queueOfDetonations.size())
-			queueOfDetonations.erase(queueOfDetonations.begin());
+	void rescheduleAt(Train& train, int tick) {
+		train.wakeTick = tick;
+		if (tick != -1) events.emplace(tick, train.id);
 	}
 
-	double dist(std::pair<int, int>& pos1, std::pair<int, int>& pos2) {
-		return sqrt(abs(pos1.first - pos2.first) * abs(pos1.first - pos2.first) + abs(pos1.second - pos2.second) * abs(pos1.second - pos2.second));
+	void findClosestBlockade(Train& train) {
+		train.blockade = nullptr;
+		for (auto& blockade : devilishBlockade) {
+			if (dist(train.pos, blockade->pos) < 30) {
+				train.blockade = blockade.get();
+				break;
+			}
+		}
+		train.state = (train.blockade == nullptr ? moving : stopped);
 	}
-};
 
-class App : public olc::PixelGameEngine
-{
-	Deifi myDeifi;
-	Engel mvvRep;
+	void moveTrain(Train& train) {
+		std::pair<int, int> target = stations[train.destination.first].lanePosition(train.destination.second);
+		std::pair<int, int> origin = stations[lineOf(train).stops[train.idx]].lanePosition(train.direction);
 
-	std::vector<std::pair<int, int>> detonations;
+		addPair(train.pos, { (target.first - origin.first) / stepsize, (target.second - origin.second) / stepsize });
 
-	Graph graph;
+		if (dist(train.pos, target) < 10) {
+			train.pos = target;
+			train.angle = stations[train.destination.first].angle;
+			train.arrived = true;
+		}
+	}
 
-	bool pauseGame = false;
-public:
-	App()
-	{
-		sAppName = "Trains";
+	void arriveAtStation(Train& train) {
+		const Line& line = lineOf(train);
+		unregisterTrain(line.stops[train.idx], laneOf(train), train.id);
+		bool wasNext = stations[train.destination.first].removeIncomingTrain(train.id, train.destination.second);
+		stations[train.destination.first].registerTrain(train.id, train.direction);
+		if (wasNext) {
+			laneChanged(train.destination.first, train.destination.second, train.id);
+		}
+		train.updatePositionAndDirection(line);
+		train.state = boarding;
 	}
 
-	bool OnUserCreate() override
-	{
-		graph = Graph(ScreenWidth(), ScreenHeight());
-		Clear(olc::BLANK);
-		DrawInstructions();
-		InitializeDeifiAndMvvRep();
+	// Unless the train is about to leave service the passengers waiting
+	// for it get on, then those whose ride ends here get off. Only the
+	// passengers waiting here and the train's bucket for this stop are
+	// looked at.
+	void boardPassengers(Train& train, bool takeOn = true) {
+		olc::AllocationScope scope(MEM_PASSENGERS);
+		if (cohortDemand) {
+			boardCohorts(train, takeOn);
+			return;
+		}
+		const Line& line = lineOf(train);
+		int here = line.stops[train.idx];
+		Station& station = stations[here];
+
+		if (takeOn) {
+			int kept = 0;
+			for (int i : station.waitingPassengers) {
+				Passenger& slave = slaves[i];
+				if (slave.legDirection != train.direction || !(slave.lineMask & (1u << train.myLine))) {
+					station.waitingPassengers[kept++] = i;
+					continue;
+				}
+				if (!slave.leg) {
+					slave.timeToStartWorking += globalTime;
+					watchSlave(i);
+				}
+				slave.origin = -1;
+				slaveInfo[i].train = train.id;
+				train.riders[line.stopIndex[slave.legTo]].push_back(i);
+				++train.riding;
+			}
+			station.waitingPassengers.resize(kept);
+		}
 
-		DrawString(10, 10, "Score: ", olc::RED, 2);
-		DrawString(10, 40, "Time: ", olc::RED, 2);
-		DrawString(10, 70, "Blocks: ", olc::RED, 2);
+		// Off for good or to change trains here
+		std::vector<int>& alighting = train.riders[train.idx];
+		for (int i : alighting) {
+			Passenger& slave = slaves[i];
+			if (++slave.leg == planner.journeys[slaveInfo[i].journey].legs.size()) {
+				++delivered;
+				slave.origin = -2;
+				freeSlaves.push_back(i);
+			}
+			else {
+				slave.origin = here;
+				startLeg(i);
+				station.waitingPassengers.push_back(i);
+			}
+		}
+		train.riding -= alighting.size();
+		alighting.clear();
+	}
 
-		DrawGraphOfStations();
-		DrawAllTrains();
-		DrawObject(myDeifi, olc::vf2d{ 2.f,1.5f });
-		DrawObject(mvvRep);
+	// Index of an unused passenger slot
+	int newSlave() {
+		if (freeSlaves.empty()) {
+			slaves.emplace_back();
+			slaveInfo.emplace_back();
+			return slaves.size() - 1;
+		}
+		int i = freeSlaves.back();
+		freeSlaves.pop_back();
+		return i;
+	}
 
-		return true;
+	int passengerCount() const {
+		return slaves.size() - freeSlaves.size();
 	}
 
-	bool OnUserUpdate(float fElapsedTime) override
-	{
-		DisplayData();
+	// Copies what boarding needs to know about the current leg
+	void startLeg(int i) {
+		const Leg& leg = planner.journeys[slaveInfo[i].journey].legs[slaves[i].leg];
+		slaves[i].legTo = leg.to;
+		slaves[i].legDirection = leg.direction;
+		slaves[i].lineMask = leg.lineMask;
+	}
 
-		if (!HandleUserInput())
-			return false;
+	void startLeg(Cohort& cohort) {
+		const Leg& leg = planner.journeys[cohort.journey].legs[cohort.leg];
+		cohort.legTo = leg.to;
+		cohort.legDirection = leg.direction;
+		cohort.lineMask = leg.lineMask;
+	}
 
-		MoveMvvRep();
+	// Same journey, leg and deadline makes the same cohort
+	void addCohort(std::vector<Cohort>& cohorts, const Cohort& cohort) {
+		for (auto& other : cohorts) {
+			if (other.journey == cohort.journey && other.leg == cohort.leg &&
+				other.timeToStartWorking == cohort.timeToStartWorking) {
+				other.count += cohort.count;
+				other.delayed = std::max(other.delayed, cohort.delayed);
+				return;
+			}
+		}
+		cohorts.push_back(cohort);
+	}
 
-		for (auto& blockade : graph.devilishBlockade) {
-			DrawBlockade(blockade);
+	// Whole cohorts get off, then waiting ones get on for as long as there
+	// is room, the last one split if need be
+	void boardCohorts(Train& train, bool takeOn) {
+		int here = lineOf(train).stops[train.idx];
+		Station& station = stations[here];
+		int kept = 0;
+		for (auto& cohort : train.cohorts) {
+			if (cohort.legTo != here) {
+				train.cohorts[kept++] = cohort;
+				continue;
+			}
+			train.load -= cohort.count;
+			if (++cohort.leg == planner.journeys[cohort.journey].legs.size()) {
+				delivered += cohort.count;
+			}
+			else {
+				startLeg(cohort);
+				addCohort(station.waitingCohorts, cohort);
+				watchCohort(here, cohort.timeToStartWorking);
+			}
+		}
+		train.cohorts.resize(kept);
+		if (!takeOn) return;
+
+		for (auto& cohort : station.waitingCohorts) {
+			if (train.load == trainCapacity) break;
+			if (cohort.legDirection != train.direction || !(cohort.lineMask & (1u << train.myLine))) continue;
+			Cohort riders = cohort;
+			riders.count = std::min(cohort.count, trainCapacity - train.load);
+			if (!riders.leg)
+				riders.timeToStartWorking += globalTime;
+			cohort.count -= riders.count;
+			train.load += riders.count;
+			addCohort(train.cohorts, riders);
+			watchCohort(stations.size() + train.id, riders.timeToStartWorking);
+		}
+		station.waitingCohorts.erase(
+			std::remove_if(station.waitingCohorts.begin(), station.waitingCohorts.end(), [](auto& cohort) { return cohort.count == 0; }),
+			station.waitingCohorts.end()
+		);
+	}
+
+	// Every pair of stations that are connected at all gets a weight. The
+	// aggregate mode keeps the weights as commuters per hour at the peak,
+	// the individual mode scales them down to a few dozen in total unless
+	// peakPerHour says otherwise.
+	void buildDemand(uint32_t seed, bool aggregate, int peakPerHour) {
+		cohortDemand = aggregate;
+		int n = stations.size();
+		DemandRng rng(seed);
+		std::vector<int> weights(n * n, 0);
+		int total = 0;
+		for (int origin = 0; origin < n; ++origin) {
+			for (int destination = 0; destination < n; ++destination) {
+				int od = planner.Lookup(origin, destination);
+				if (origin == destination || planner.journeys[od].legs.empty()) continue;
+				weights[od] = 20 + rng.Next() % 60;
+				total += weights[od];
+			}
 		}
+		demand.Build(weights, n);
+		demand.rng = rng;
+		demand.peakPerHour = peakPerHour ? peakPerHour : aggregate ? total : individualPeakPerHour;
+		drawnPerPair.assign(demand.pairs.size(), 0);
+	}
 
-		DrawObject(myDeifi, olc::vf2d{ 2.f,1.5f }, olc::Pixel(min(255, 80 + 2 * graph.score), 100, 150));
-		DrawObject(mvvRep);
-		graph.handleTrains();
-		DrawAllTrains();
+	// One bucket's worth of commuters turns up at every station
+	void generateCohorts() {
+		olc::AllocationScope scope(MEM_PASSENGERS);
+		int n = stations.size();
+		demand.Draw(minuteOfDay(), cohortBucket, ticksPerHour, [&](int k) {
+			++drawnPerPair[k];
+		});
+		for (int k = 0; k < drawnPerPair.size(); ++k) {
+			if (!drawnPerPair[k]) continue;
+			int od = demand.pairs[k];
+			Cohort cohort{ od, globalTime + 10 * (100 + planner.journeys[od].stops), drawnPerPair[k] };
+			startLeg(cohort);
+			addCohort(stations[od / n].waitingCohorts, cohort);
+			watchCohort(od / n, cohort.timeToStartWorking);
+			drawnPerPair[k] = 0;
+		}
+	}
+
+	int waitingCommuters(const Station& station) const {
+		int total = 0;
+		for (auto& cohort : station.waitingCohorts) total += cohort.count;
+		return total;
+	}
+
+	// This tick's commuters, queued at their home stations
+	void generateSlaves() {
+		olc::AllocationScope scope(MEM_PASSENGERS);
+		int n = stations.size();
+		demand.Draw(minuteOfDay(), 1, ticksPerHour, [&](int k) {
+			int od = demand.pairs[k];
+			int origin = od / n;
+			int i = newSlave();
+			slaves[i] = Passenger(nextPassengerId++, globalTime + 10 * (100 + planner.journeys[od].stops), origin);
+			slaveInfo[i] = { origin, od % n, od };
+			startLeg(i);
+			watchSlave(i);
+			stations[origin].waitingPassengers.push_back(i);
+		});
+	}
+
+	void addPair(std::pair<int, int>& pos1, const std::pair<int, int>& pos2) {
+		pos1.first += pos2.first;
+		pos1.second += pos2.second;
+	}
+
+	void substractPair(std::pair<int, int>& pos1, const std::pair<int, int>& pos2) {
+		pos1.first -= pos2.first;
+		pos1.second -= pos2.second;
+	}
+
+	std::string convertGameTime() {
+		int time = globalTime / 10;
+
+		int hours = (6 + time / 60) % 24;
+		int minutes = time - 60 * (time / 60);
+		std::string mins = minutes < 10 ? "0" + std::to_string(minutes) : std::to_string(minutes);
+		return std::to_string(hours) + ":" + mins;
+	}
+
+	int dist(std::pair<int, int>& pos1, std::pair<int, int>& pos2) {
+		return abs(pos1.first - pos2.first) + abs(pos1.second - pos2.second);
+	}
+};
+
+struct Deifi {
+	std::pair<int, int> pos;
+	int nBombs;
+};
+
+// Where reps can walk: along the rails between neighbouring stations.
+// Routes between two stations are found with A* once and then shared by
+// all reps, the network never changes during a game.
+struct NavGraph {
+	std::vector<std::pair<int, int>> nodes;
+	std::vector<std::vector<std::pair<int, double>>> edges; // (station, length)
+	std::unordered_map<int, std::vector<int>> routeCache;
+
+	NavGraph() {}
+
+	NavGraph(Graph& graph) {
+		for (auto& station : graph.stations) {
+			nodes.push_back(station.pos);
+		}
+		edges.resize(nodes.size());
+		for (auto& line : graph.lines) {
+			const std::vector<int>& stops = line.stops;
+			for (int i = 1; i < stops.size(); ++i) {
+				double length = dist(nodes[stops[i - 1]], nodes[stops[i]]);
+				edges[stops[i - 1]].emplace_back(stops[i], length);
+				edges[stops[i]].emplace_back(stops[i - 1], length);
+			}
+		}
+	}
+
+	int nearestNode(const std::pair<int, int>& pos) const {
+		int best = 0;
+		for (int i = 1; i < nodes.size(); ++i) {
+			if (dist(pos, nodes[i]) < dist(pos, nodes[best])) best = i;
+		}
+		return best;
+	}
+
+	// Stations from first to last, both included, empty if there is no way
+	const std::vector<int>& route(int from, int to) {
+		olc::AllocationScope scope(MEM_NETWORK);
+		int key = from * nodes.size() + to;
+		auto it = routeCache.find(key);
+		if (it != routeCache.end()) return it->second;
+		return routeCache[key] = findRoute(from, to);
+	}
+
+	std::vector<int> findRoute(int from, int to) const {
+		std::vector<double> cost(nodes.size(), 1e18);
+		std::vector<int> previous(nodes.size(), -1);
+		std::priority_queue<std::pair<double, int>, std::vector<std::pair<double, int>>, std::greater<>> open;
+		cost[from] = 0.0;
+		open.emplace(dist(nodes[from], nodes[to]), from);
+		while (!open.empty()) {
+			auto [estimate, node] = open.top();
+			open.pop();
+			if (node == to) break;
+			if (estimate > cost[node] + dist(nodes[node], nodes[to])) continue; // Stale entry
+			for (auto [next, length] : edges[node]) {
+				if (cost[node] + length < cost[next]) {
+					cost[next] = cost[node] + length;
+					previous[next] = node;
+					open.emplace(cost[next] + dist(nodes[next], nodes[to]), next);
+				}
+			}
+		}
+		std::vector<int> stations;
+		if (from != to && previous[to] == -1) return stations;
+		for (int node = to; node != -1; node = previous[node]) {
+			stations.push_back(node);
+		}
+		std::reverse(stations.begin(), stations.end());
+		return stations;
+	}
+
+	static double dist(const std::pair<int, int>& pos1, const std::pair<int, int>& pos2) {
+		return sqrt(double(pos1.first - pos2.first) * (pos1.first - pos2.first) + double(pos1.second - pos2.second) * (pos1.second - pos2.second));
+	}
+};
+
+struct Engel {
+	int id;
+	int removeTime = 20;
+	static constexpr int speed = 15;
+	std::pair<int, int> pos;
+	DevilishBlockade* target = nullptr;
+	std::vector<int> route; // Stations still to pass, the next one at the back
+	bool planned = false;
+
+	bool removeBlockade() {
+		--removeTime;
+		if (!removeTime) {
+			removeTime = 20;
+			return true;
+		}
+		return false;
+	}
+
+	// Busy taking a blockade apart, too late to send the rep elsewhere
+	bool working() const {
+		return removeTime < 20;
+	}
+
+	// The route is kept, the rep walks on to the station it is heading for
+	// and only the rest of the way is planned anew
+	void setTarget(DevilishBlockade* blockade) {
+		target = blockade;
+		planned = false;
+		removeTime = 20;
+	}
+
+	// Returns true once the rep stands at its target
+	bool Move(NavGraph& nav) {
+		if (!target) return false;
+		if (!planned) plan(nav);
+		if (route.empty()) return stepTowards(target->pos);
+		if (stepTowards(nav.nodes[route.back()])) route.pop_back();
+		return false;
+	}
+
+	// Follow the rails unless the way to and from them is already longer
+	// than walking straight to the target
+	void plan(NavGraph& nav) {
+		planned = true;
+		int from = route.empty() ? nav.nearestNode(pos) : route.back();
+		int to = nav.nearestNode(target->pos);
+		route.clear();
+		double straight = NavGraph::dist(pos, target->pos);
+		if (from == to || straight <= NavGraph::dist(pos, nav.nodes[from]) + NavGraph::dist(nav.nodes[to], target->pos)) return;
+		const std::vector<int>& stations = nav.route(from, to);
+		route.assign(stations.rbegin(), stations.rend());
+	}
+
+	bool stepTowards(const std::pair<int, int>& goal) {
+		double d = NavGraph::dist(pos, goal);
+		if (d <= speed) {
+			pos = goal;
+			return true;
+		}
+		pos.first += int((goal.first - pos.first) * speed / d);
+		pos.second += int((goal.second - pos.second) * speed / d);
+		return false;
+	}
+
+	double dist(const std::pair<int, int>& pos1, const std::pair<int, int>& pos2) const {
+		return NavGraph::dist(pos1, pos2);
+	}
+};
+
+// Blockades no rep is on yet, bucketed by position so that the one
+// closest to a rep is found without looking at all of them
+struct BlockadeGrid {
+	static constexpr int cellSize = 64;
+	int columns = 0;
+	int rows = 0;
+	int count = 0;
+	std::vector<std::vector<DevilishBlockade*>> cells;
+
+	BlockadeGrid() {}
+
+	BlockadeGrid(int width, int height)
+		: columns(width / cellSize + 1), rows(height / cellSize + 1), cells(columns * rows) {}
+
+	int cellOf(const std::pair<int, int>& pos) const {
+		int x = std::clamp(pos.first / cellSize, 0, columns - 1);
+		int y = std::clamp(pos.second / cellSize, 0, rows - 1);
+		return y * columns + x;
+	}
+
+	void insert(DevilishBlockade* blockade) {
+		cells[cellOf(blockade->pos)].push_back(blockade);
+		++count;
+	}
+
+	// The blockade must not have moved since it was inserted
+	void remove(DevilishBlockade* blockade) {
+		auto& cell = cells[cellOf(blockade->pos)];
+		auto it = std::find(cell.begin(), cell.end(), blockade);
+		if (it != cell.end()) {
+			cell.erase(it);
+			--count;
+		}
+	}
+
+	// Removes and returns the blockade closest to pos, or nullptr. Cells are
+	// searched in growing rings around pos. Everything in ring r is at least
+	// (r - 1) cells away, so we can stop once the best find is closer.
+	DevilishBlockade* takeNearest(const std::pair<int, int>& pos) {
+		if (!count) return nullptr;
+		int cx = cellOf(pos) % columns;
+		int cy = cellOf(pos) / columns;
+		DevilishBlockade* best = nullptr;
+		long long bestDist = LLONG_MAX;
+		for (int r = 0; r < std::max(columns, rows); ++r) {
+			for (int y = cy - r; y <= cy + r; ++y) {
+				if (y < 0 || y >= rows) continue;
+				for (int x = cx - r; x <= cx + r; ++x) {
+					if (x < 0 || x >= columns) continue;
+					if (abs(x - cx) != r && abs(y - cy) != r) continue; // Inner rings are done
+					for (auto* blockade : cells[y * columns + x]) {
+						long long dx = blockade->pos.first - pos.first;
+						long long dy = blockade->pos.second - pos.second;
+						if (dx * dx + dy * dy < bestDist) {
+							bestDist = dx * dx + dy * dy;
+							best = blockade;
+						}
+					}
+				}
+			}
+			long long reach = (long long)r * cellSize;
+			if (best && bestDist <= reach * reach) break;
+		}
+		if (best) remove(best);
+		return best;
+	}
+};
+
+// Counters the simulation hands to the metrics exporter after every tick
+enum MetricField {
+	M_TICK, M_SCORE, M_WAITING, M_RIDING, M_DELIVERED,
+	M_TRAINS_MOVING, M_TRAINS_STOPPED, M_TRAINS_AT_STATION,
+	M_QUEUED_TRAINS, M_LONGEST_QUEUE, M_BLOCKADES,
+	// Live kilobytes per MemoryTag, in the same order
+	M_HEAP_ENGINE, M_HEAP_ASSETS, M_HEAP_NETWORK, M_HEAP_PASSENGERS, M_HEAP_TRAINS, M_HEAP_BLOCKADES,
+	M_FIELD_COUNT
+};
+
+struct TickMetrics {
+	int64_t value[M_FIELD_COUNT] = {};
+};
 
-		for (auto& station : graph.stations) DrawStation(station);
+// Single producer, single consumer queue. Each side only writes its own
+// index and the producer keeps a stale copy of the consumer's, so a push
+// is a copy and one release store: no lock and no system call.
+template<typename T>
+struct SpscRing {
+	std::vector<T> items;
+	uint32_t mask = 0;
+	alignas(64) std::atomic<uint32_t> head{ 0 };	// Next slot to write
+	uint32_t cachedTail = 0;
+	alignas(64) std::atomic<uint32_t> tail{ 0 };	// Next slot to read
+
+	// Capacity is rounded up to a power of two
+	SpscRing(int capacity) {
+		uint32_t size = 1;
+		while (size < capacity) size <<= 1;
+		items.resize(size);
+		mask = size - 1;
+	}
 
+	// Producer only, false when the consumer has fallen a full ring behind
+	bool Push(const T& item) {
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if (h - cachedTail == items.size()) {
+			cachedTail = tail.load(std::memory_order_acquire);
+			if (h - cachedTail == items.size()) return false;
+		}
+		items[h & mask] = item;
+		head.store(h + 1, std::memory_order_release);
 		return true;
 	}
 
-	void DrawInstructions() {
-		DrawString(ScreenWidth() / 2 - 50, 20, "Press arrow keys to Move");
-		DrawString(ScreenWidth() / 2 - 50, 40, "Press space to setup blockade");
-		DrawString(ScreenWidth() / 2 - 50, 60, "Press escape to exit");
+	// Consumer only
+	bool Pop(T& item) {
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire)) return false;
+		item = items[t & mask];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
 	}
+};
 
-	void InitializeDeifiAndMvvRep() {
-		myDeifi.pos = std::pair<int, int>{ ScreenWidth() / 2, ScreenHeight() / 2 };
-		myDeifi.nBombs = 100;
-		myDeifi.sprite = new olc::Sprite("./Sprites/Deifi.png");
-		myDeifi.decal = new olc::Decal(myDeifi.sprite);
+// Drains the ring on its own thread, sums the ticks up into one row per
+// window and writes the rows as CSV (.csv) or JSON lines (anything else).
+// A .prom file is instead rewritten with the latest window in Prometheus'
+// text format for a node exporter's textfile collector to pick up.
+struct MetricsExporter {
+	enum Format { CSV, JSONL, PROMETHEUS };
+	enum Aggregate { LAST, MEAN, MAX, DELTA };
+	struct Column {
+		const char* name;
+		MetricField field;
+		Aggregate aggregate;
+		const char* help;
+	};
+	static constexpr Column columns[] = {
+		{ "tick", M_TICK, LAST, "Simulation tick" },
+		{ "score", M_SCORE, LAST, "Ticks commuters have been late in total" },
+		{ "late", M_SCORE, DELTA, "Ticks commuters were late within the window" },
+		{ "waiting", M_WAITING, MEAN, "Commuters waiting at stations" },
+		{ "waiting_max", M_WAITING, MAX, "Most commuters waiting at stations at once" },
+		{ "riding", M_RIDING, MEAN, "Commuters on trains" },
+		{ "delivered", M_DELIVERED, LAST, "Commuters that reached their destination" },
+		{ "trains_moving", M_TRAINS_MOVING, MEAN, "Trains between stations" },
+		{ "trains_stopped", M_TRAINS_STOPPED, MEAN, "Trains held up by a blockade" },
+		{ "trains_at_station", M_TRAINS_AT_STATION, MEAN, "Trains boarding or waiting to leave" },
+		{ "queued_trains", M_QUEUED_TRAINS, MEAN, "Trains queued for a station lane" },
+		{ "longest_queue", M_LONGEST_QUEUE, MAX, "Longest queue for a station lane" },
+		{ "blockades", M_BLOCKADES, LAST, "Blockades on the network" },
+		{ "heap_kb_engine", M_HEAP_ENGINE, LAST, "Live heap of the engine and everything untagged in kilobytes" },
+		{ "heap_kb_assets", M_HEAP_ASSETS, LAST, "Live heap of sprites and decals in kilobytes" },
+		{ "heap_kb_network", M_HEAP_NETWORK, LAST, "Live heap of stations, lines and routes in kilobytes" },
+		{ "heap_kb_passengers", M_HEAP_PASSENGERS, LAST, "Live heap of passengers and cohorts in kilobytes" },
+		{ "heap_kb_trains", M_HEAP_TRAINS, LAST, "Live heap of trains and their scheduling in kilobytes" },
+		{ "heap_kb_blockades", M_HEAP_BLOCKADES, LAST, "Live heap of blockades in kilobytes" },
+	};
+	static constexpr int nColumns = sizeof(columns) / sizeof(Column);
+	// A tenth of a second of fast forward, many polls' worth
+	static constexpr int ringCapacity = 1 << 14;
+	static constexpr int pollMilliseconds = 20;
+
+	SpscRing<TickMetrics> ring{ ringCapacity };
+	std::thread worker;
+	std::atomic<bool> bRunning{ false };
+	uint32_t nDropped = 0;	// Producer only
+
+	Format format = JSONL;
+	std::string sFile;
+	std::ofstream ofs;
+	int ticksPerRow = 10;
+	// The window being summed up, worker only. Windows follow the tick
+	// numbers, so ticks dropped on a full ring leave a row with fewer
+	// ticks instead of stretching it.
+	int nTicks = 0;
+	int64_t nWindow = -1;
+	int64_t sum[nColumns] = {};
+	int64_t highest[nColumns] = {};
+	int64_t last[M_FIELD_COUNT] = {};
+	int64_t windowStart[M_FIELD_COUNT] = {};
+	double row[nColumns] = {};
+	int nRows = 0;
+	int nRowsFlushed = 0;
+
+	~MetricsExporter() {
+		Stop();
+	}
 
-		mvvRep.id = 1;
-		mvvRep.pos.first = ScreenWidth() / 2;
-		mvvRep.pos.second = ScreenHeight() / 4;
-		mvvRep.oldPos = mvvRep.pos;
-		mvvRep.sprite = new olc::Sprite("./Sprites/Engel.png");
-		mvvRep.decal = new olc::Decal(mvvRep.sprite);
+	bool Start(const std::string& file, int ticksPerWindow = 10) {
+		sFile = file;
+		ticksPerRow = ticksPerWindow;
+		auto endsWith = [&](const char* suffix) {
+			size_t n = strlen(suffix);
+			return sFile.size() >= n && sFile.compare(sFile.size() - n, n, suffix) == 0;
+		};
+		format = endsWith(".csv") ? CSV : endsWith(".prom") ? PROMETHEUS : JSONL;
+		if (format != PROMETHEUS) {
+			ofs.open(sFile);
+			if (!ofs.is_open()) return false;
+			ofs.precision(12);
+			if (format == CSV) {
+				for (int c = 0; c < nColumns; ++c) ofs << (c ? "," : "") << columns[c].name;
+				ofs << "\n";
+			}
+		}
+		bRunning = true;
+		worker = std::thread(&MetricsExporter::Run, this);
+		return true;
+	}
 
+	bool IsRunning() const {
+		return bRunning;
 	}
 
-	void DisplayData() {
+	// Called from the simulation thread after every tick. When the exporter
+	// can't keep up the tick is dropped rather than waited for.
+	void Push(const TickMetrics& metrics) {
+		if (!ring.Push(metrics)) ++nDropped;
+	}
+
+	// Writes whatever is still queued, including a partial last window
+	void Stop() {
+		if (!bRunning) return;
+		bRunning = false;
+		worker.join();
+		if (nTicks) EndWindow();
+		Flush();
+		ofs.close();
+		if (nDropped)
+			printf("NOTE: %u ticks were left out of %s, the exporter could not keep up\n", nDropped, sFile.c_str());
+	}
+
+	void Run() {
+		while (bRunning) {
+			Drain();
+			std::this_thread::sleep_for(std::chrono::milliseconds(pollMilliseconds));
+		}
+		Drain();
+	}
+
+	void Drain() {
+		TickMetrics metrics;
+		bool any = false;
+		while (ring.Pop(metrics)) {
+			Add(metrics);
+			any = true;
+		}
+		if (any) Flush();
+	}
+
+	void Add(const TickMetrics& metrics) {
+		int64_t tick = metrics.value[M_TICK];
+		if (nTicks && tick / ticksPerRow != nWindow) EndWindow();
+		nWindow = tick / ticksPerRow;
+		for (int c = 0; c < nColumns; ++c) {
+			int64_t value = metrics.value[columns[c].field];
+			sum[c] += value;
+			highest[c] = nTicks ? std::max(highest[c], value) : value;
+		}
+		std::copy(metrics.value, metrics.value + M_FIELD_COUNT, last);
+		++nTicks;
+		if ((tick + 1) % ticksPerRow == 0) EndWindow();
+	}
+
+	void EndWindow() {
+		for (int c = 0; c < nColumns; ++c) {
+			MetricField field = columns[c].field;
+			switch (columns[c].aggregate) {
+			case LAST: row[c] = last[field]; break;
+			case MEAN: row[c] = double(sum[c]) / nTicks; break;
+			case MAX: row[c] = highest[c]; break;
+			case DELTA: row[c] = last[field] - windowStart[field]; break;
+			}
+			sum[c] = 0;
+		}
+		std::copy(last, last + M_FIELD_COUNT, windowStart);
+		nTicks = 0;
+		++nRows;
+		if (format == CSV) {
+			for (int c = 0; c < nColumns; ++c) ofs << (c ? "," : "") << row[c];
+			ofs << "\n";
+		}
+		else if (format == JSONL) {
+			for (int c = 0; c < nColumns; ++c) ofs << (c ? ",\"" : "{\"") << columns[c].name << "\":" << row[c];
+			ofs << "}\n";
+		}
+	}
+
+	// Rows go out once per poll, the Prometheus file is replaced whole so
+	// that a scrape never sees half of it, and only when there is a new row
+	void Flush() {
+		if (format != PROMETHEUS) {
+			ofs.flush();
+			return;
+		}
+		if (nRows == nRowsFlushed) return;
+		nRowsFlushed = nRows;
+		std::string sTemp = sFile + ".tmp";
+		std::ofstream prom(sTemp);
+		prom.precision(12);
+		for (int c = 0; c < nColumns; ++c) {
+			bool counter = columns[c].aggregate == LAST && (columns[c].field == M_SCORE || columns[c].field == M_DELIVERED);
+			prom << "# HELP mvv_" << columns[c].name << " " << columns[c].help << "\n";
+			prom << "# TYPE mvv_" << columns[c].name << (counter ? " counter\n" : " gauge\n");
+			prom << "mvv_" << columns[c].name << " " << row[c] << "\n";
+		}
+		prom.close();
+		std::rename(sTemp.c_str(), sFile.c_str());
+	}
+};
+
+// Every key the game listens to fits into one byte per tick
+enum InputBits : uint8_t {
+	IN_LEFT = 1 << 0, IN_RIGHT = 1 << 1, IN_UP = 1 << 2, IN_DOWN = 1 << 3,
+	IN_BLOCKADE = 1 << 4, IN_DEFUSE = 1 << 5, IN_SPIN = 1 << 6, IN_QUIT = 1 << 7
+};
+
+// The whole simulation, without any sprites or decals, so that it
+// can be stepped headless from a recorded session
+struct World {
+	int width = 0;
+	int height = 0;
+	Deifi myDeifi;
+	static constexpr int nMvvReps = 3;
+	std::vector<Engel> mvvReps;
+	BlockadeGrid unassignedBlockades;
+	Graph graph;
+	NavGraph nav;
+
+	World() {}
+
+	World(int width, int height, unsigned int seed, bool cohortDemand = false, int demandPerHour = 0) : width(width), height(height) {
+		olc::AllocationScope scope(MEM_NETWORK);
+		graph = Graph(width, height);
+		graph.buildDemand(seed, cohortDemand, demandPerHour);
+
+		myDeifi.pos = std::pair<int, int>{ width / 2, height / 2 };
+		myDeifi.nBombs = 100;
+
+		mvvReps.resize(nMvvReps);
+		for (int i = 0; i < nMvvReps; ++i) {
+			mvvReps[i].id = i + 1;
+			mvvReps[i].pos.first = width * (i + 1) / (nMvvReps + 1);
+			mvvReps[i].pos.second = height / 4;
+		}
+		unassignedBlockades = BlockadeGrid(width, height);
+		nav = NavGraph(graph);
+	}
+
+	// Advance the simulation by one tick, returns false once the player quits
+	bool Step(uint8_t input) {
 		UpdateScore();
-		FillRect(110, 10, 200, 30, olc::BLANK);
-		DrawString(110, 10, std::to_string(graph.score), olc::RED, 2);
-		if (!(graph.globalTime % 10)) {
-			FillRect(110, 40, 200, 80, olc::BLANK);
-			DrawString(110, 40, graph.convertGameTime(), olc::RED, 2);
-
-			if (!(graph.globalTime % 1000)) {
-				graph.generateSlaves();
-				for (auto& station : graph.stations) {
-					DrawStation(station);
+		if (graph.cohortDemand) {
+			if (!(graph.globalTime % Graph::cohortBucket)) {
+				graph.generateCohorts();
+			}
+		}
+		else {
+			graph.generateSlaves();
+		}
+
+		if (input & IN_QUIT) {
+			return false;
+		}
+		if (input & IN_LEFT) {
+			addPairs(myDeifi.pos, { -5,0 });
+		}
+		if (input & IN_RIGHT) {
+			addPairs(myDeifi.pos, { 5,0 });
+		}
+		if (input & IN_UP) {
+			addPairs(myDeifi.pos, { 0,-5 });
+		}
+		if (input & IN_DOWN) {
+			addPairs(myDeifi.pos, { 0,5 });
+		}
+		if ((input & IN_BLOCKADE) && myDeifi.nBombs && !mvvRepNear(myDeifi.pos, 20)) {
+			olc::AllocationScope scope(MEM_BLOCKADES);
+			//--myDeifi.nBombs;
+			graph.devilishBlockade.push_back(std::make_unique<DevilishBlockade>(myDeifi.pos));
+			assignBlockade(graph.devilishBlockade.back().get());
+			graph.blockadesChanged();
+		}
+		if (input & IN_DEFUSE) {
+			graph.syncTrains();
+			for (auto& train : graph.trains) {
+				if (train.blockade && !train.blockade->defused) {
+					unassignBlockade(train.blockade);
+					train.blockade->defused = true;
+					train.blockade->pos = std::pair<int, int>{ 0,0 };
 				}
 			}
+			graph.blockadesChanged();
 		}
-		FillRect(110, 70, 200, 30, olc::BLANK);
-		DrawString(110, 70, std::to_string(myDeifi.nBombs), olc::RED, 2);
+
+		MoveMvvReps();
+		graph.handleTrains();
+		return true;
 	}
 
+	// Only commuters whose deadline has passed are looked at, found through
+	// the queues of when each passenger and each station's or train's
+	// cohorts are late next. The cost follows the number of late commuters,
+	// not the number of passengers and trains.
 	void UpdateScore() {
-		for (auto& slave : graph.slaves) {
-			if (slave.timeToStartWorking + 10 < graph.globalTime) { // slave.origin == -1 &&
-				slave.timeToStartWorking = graph.globalTime;
-				++slave.delayed;
-				++graph.score;
+		int now = graph.globalTime;
+		while (!graph.lateSlaves.empty() && graph.lateSlaves.top().first <= now) {
+			auto [tick, i] = graph.lateSlaves.top();
+			graph.lateSlaves.pop();
+			Passenger& slave = graph.slaves[i];
+			if (slave.origin == -2 || Graph::lateTick(slave.timeToStartWorking) != tick) continue; // Arrived or rescheduled since
+			slave.timeToStartWorking = now;
+			graph.watchSlave(i);
+			if (slave.delayed < UINT16_MAX) ++slave.delayed;
+			++graph.score;
+			if (slave.origin >= 0) graph.delays.atStation(slave.origin, 1);
+			else graph.lateOnTrain(graph.trains[graph.slaveInfo[i].train], 1);
+		}
+		while (!graph.lateCohorts.empty() && graph.lateCohorts.top().first <= now) {
+			auto [tick, holder] = graph.lateCohorts.top();
+			graph.lateCohorts.pop();
+			int& due = graph.cohortsLateAt(holder);
+			if (due != tick) continue;
+			due = INT_MAX;
+			int late = 0;
+			int earliest = INT_MAX;
+			for (auto& cohort : graph.cohortsOf(holder)) {
+				if (cohort.timeToStartWorking + 10 < now) {
+					cohort.timeToStartWorking = now;
+					if (cohort.delayed < UINT16_MAX) ++cohort.delayed;
+					late += cohort.count;
+				}
+				earliest = std::min(earliest, cohort.timeToStartWorking);
+			}
+			if (earliest != INT_MAX) graph.watchCohort(holder, earliest);
+			graph.score += late;
+			if (!late) continue;
+			if (holder < graph.stations.size()) graph.delays.atStation(holder, late);
+			else graph.lateOnTrain(graph.trains[holder - graph.stations.size()], late);
+		}
+	}
+
+	bool mvvRepNear(std::pair<int, int>& pos, int radius) {
+		for (auto& rep : mvvReps) {
+			if (dist(pos, rep.pos) <= radius) return true;
+		}
+		return false;
+	}
+
+	// A new blockade goes to the closest idle rep. If nobody is idle, the rep
+	// that saves the most way by turning around takes it, as long as it has
+	// not started working yet, and puts its old target back into the pool.
+	void assignBlockade(DevilishBlockade* blockade) {
+		Engel* best = nullptr;
+		double bestDist = 1e18;
+		for (auto& rep : mvvReps) {
+			if (rep.target == nullptr && rep.dist(rep.pos, blockade->pos) < bestDist) {
+				bestDist = rep.dist(rep.pos, blockade->pos);
+				best = &rep;
+			}
+		}
+		if (best) {
+			best->setTarget(blockade);
+			return;
+		}
+
+		double bestGain = 0.0;
+		for (auto& rep : mvvReps) {
+			double gain = rep.dist(rep.pos, rep.target->pos) - rep.dist(rep.pos, blockade->pos);
+			if (!rep.working() && gain > bestGain) {
+				bestGain = gain;
+				best = &rep;
+			}
+		}
+		if (best) {
+			unassignedBlockades.insert(best->target);
+			best->setTarget(blockade);
+		}
+		else {
+			unassignedBlockades.insert(blockade);
+		}
+	}
+
+	// The blockade no longer needs a rep, someone on it looks for new work
+	void unassignBlockade(DevilishBlockade* blockade) {
+		for (auto& rep : mvvReps) {
+			if (rep.target == blockade) {
+				rep.setTarget(unassignedBlockades.takeNearest(rep.pos));
+				return;
 			}
 		}
+		unassignedBlockades.remove(blockade);
+	}
+
+	void MoveMvvReps() {
+		for (auto& rep : mvvReps) {
+			if (rep.target && rep.Move(nav) && rep.removeBlockade()) {
+				DevilishBlockade* cleared = rep.target;
+				graph.syncTrains();
+				for (auto& train : graph.trains) {
+					if (train.blockade == cleared) {
+						train.blockade = nullptr;
+					}
+				}
+				graph.devilishBlockade.erase(
+					std::remove_if(graph.devilishBlockade.begin(), graph.devilishBlockade.end(), [&](auto& blockade) { return blockade.get() == cleared; }),
+					graph.devilishBlockade.end()
+				);
+
+				rep.setTarget(unassignedBlockades.takeNearest(rep.pos));
+				graph.blockadesChanged();
+			}
+		}
+	}
+
+	// What the metrics exporter gets after every tick, without looking at
+	// single passengers so that it stays cheap on large runs
+	TickMetrics Metrics() const {
+		TickMetrics metrics;
+		int64_t* value = metrics.value;
+		value[M_TICK] = graph.globalTime;
+		value[M_SCORE] = graph.score;
+		value[M_DELIVERED] = graph.delivered;
+		value[M_BLOCKADES] = graph.devilishBlockade.size();
+		for (auto& station : graph.stations) {
+			value[M_WAITING] += station.waitingPassengers.size() + graph.waitingCommuters(station);
+			int queued = station.queOnLane1.size() + station.queOnLane2.size();
+			value[M_QUEUED_TRAINS] += queued;
+			value[M_LONGEST_QUEUE] = std::max<int64_t>({ value[M_LONGEST_QUEUE], station.queOnLane1.size(), station.queOnLane2.size() });
+		}
+		for (auto& train : graph.trains) {
+			if (train.state == retired) continue;
+			value[M_RIDING] += train.riding + train.load;
+			if (train.state == stopped) ++value[M_TRAINS_STOPPED];
+			else if (train.state == moving || train.state == readyToMove) ++value[M_TRAINS_MOVING];
+			else ++value[M_TRAINS_AT_STATION];
+		}
+		for (int tag = 0; tag < MEM_TAG_COUNT; ++tag) {
+			value[M_HEAP_ENGINE + tag] = olc::Allocations::Get(tag).nLiveBytes / 1024;
+		}
+		return metrics;
+	}
+
+	// FNV-1a over everything that influences later ticks, used to
+	// check that a replay follows the recorded session exactly
+	uint32_t Checksum() {
+		uint32_t hash = 2166136261u;
+		auto mix = [&](int value) {
+			for (int i = 0; i < 4; ++i) {
+				hash ^= (value >> (8 * i)) & 0xFF;
+				hash *= 16777619u;
+			}
+		};
+		mix(graph.globalTime);
+		mix(int(graph.score)); // Low half, as recorded sessions have it
+		for (auto& train : graph.trains) {
+			std::pair<int, int> pos = graph.trainPosition(train);
+			mix(pos.first); mix(pos.second);
+			mix(train.state); mix(train.idx); mix(train.direction); mix(train.myLine);
+			mix(train.riding);
+			mix(train.load);
+		}
+		for (auto& station : graph.stations) {
+			mix(station.occupiedLanes.first); mix(station.occupiedLanes.second);
+			mix(station.queOnLane1.size()); mix(station.queOnLane2.size());
+			for (auto& cohort : station.waitingCohorts) {
+				mix(cohort.journey); mix(cohort.count); mix(cohort.timeToStartWorking);
+			}
+		}
+		mix(graph.passengerCount());
+		for (auto& slave : graph.slaves) {
+			if (slave.origin == -2) continue;
+			mix(slave.id); mix(slave.origin); mix(slave.leg);
+			mix(slave.timeToStartWorking); mix(slave.delayed);
+		}
+		for (auto& blockade : graph.devilishBlockade) {
+			mix(blockade->pos.first); mix(blockade->pos.second);
+		}
+		mix(myDeifi.pos.first); mix(myDeifi.pos.second);
+		for (auto& rep : mvvReps) {
+			mix(rep.pos.first); mix(rep.pos.second);
+			mix(rep.removeTime);
+			mix(rep.target != nullptr);
+			mix(rep.route.size());
+		}
+		mix(unassignedBlockades.count);
+		return hash;
 	}
 
-	bool HandleUserInput()
+	void addPairs(std::pair<int, int>& current, const std::pair<int, int>& toAdd) {
+		current.first += toAdd.first;
+		current.second += toAdd.second;
+	}
+
+	int dist(std::pair<int, int>& pos1, std::pair<int, int> pos2) {
+		return (int)sqrt((pos1.first - pos2.first) * (pos1.first - pos2.first) +
+			(pos1.second - pos2.second) * (pos1.second - pos2.second));
+	}
+};
+
+// A session file is a small header followed by one record per tick
+// holding the input byte and the world checksum after that tick
+struct SessionHeader {
+	char magic[4] = { 'M','V','V','R' };
+	uint32_t version = 4;
+	uint32_t seed = 1;
+	int32_t width = 0;
+	int32_t height = 0;
+	uint32_t cohortDemand = 0;
+	int32_t demandPerHour = 0;	// Peak, 0 for the mode's default
+};
+
+struct SessionRecorder {
+	std::ofstream ofs;
+
+	bool Open(const std::string& sFile, const SessionHeader& header) {
+		ofs.open(sFile, std::ofstream::binary);
+		if (!ofs.is_open()) return false;
+		ofs.write((char*)&header, sizeof(SessionHeader));
+		return true;
+	}
+
+	void Record(uint8_t input, uint32_t checksum) {
+		if (!ofs.is_open()) return;
+		ofs.write((char*)&input, sizeof(uint8_t));
+		ofs.write((char*)&checksum, sizeof(uint32_t));
+	}
+};
+
+struct SessionPlayer {
+	std::ifstream ifs;
+	SessionHeader header;
+
+	bool Open(const std::string& sFile) {
+		ifs.open(sFile, std::ifstream::binary);
+		if (!ifs.is_open()) return false;
+		ifs.read((char*)&header, sizeof(SessionHeader));
+		return ifs && std::string(header.magic, 4) == "MVVR" && header.version == SessionHeader().version;
+	}
+
+	bool Next(uint8_t& input, uint32_t& checksum) {
+		return ifs.read((char*)&input, sizeof(uint8_t)) && ifs.read((char*)&checksum, sizeof(uint32_t));
+	}
+};
+
+// Runs a recorded session as fast as possible without a window and
+// stops at the first tick whose state differs from the recording
+int ReplaySession(const std::string& sFile, const std::string& sMetricsFile = "") {
+	SessionPlayer player;
+	if (!player.Open(sFile)) {
+		printf("%s is not a session recording of this version\n", sFile.c_str());
+		return 1;
+	}
+
+	std::vector<uint8_t> inputs;
+	std::vector<uint32_t> checksums;
+	uint8_t input;
+	uint32_t checksum;
+	while (player.Next(input, checksum)) {
+		inputs.push_back(input);
+		checksums.push_back(checksum);
+	}
+
+	SessionHeader& header = player.header;
+	World world(header.width, header.height, header.seed, header.cohortDemand, header.demandPerHour);
+	olc::JobSystem jobs;
+	world.graph.jobs = &jobs;
+	MetricsExporter metrics;
+	if (!sMetricsFile.empty() && !metrics.Start(sMetricsFile)) {
+		printf("Cannot write metrics to %s\n", sMetricsFile.c_str());
+		return 1;
+	}
+	auto start = std::chrono::steady_clock::now();
+	size_t tick = 0;
+	for (; tick < inputs.size(); ++tick) {
+		bool running = world.Step(inputs[tick]);
+		if (metrics.IsRunning()) metrics.Push(world.Metrics());
+		if (world.Checksum() != checksums[tick]) {
+			printf("Replay diverged at tick %zu\n", tick);
+			return 1;
+		}
+		if (!running) {
+			++tick;
+			break;
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	printf("Replayed %zu ticks in %.3fs (%.0f ticks/s)\n", tick, elapsed.count(),
+		elapsed.count() > 0 ? tick / elapsed.count() : 0.0);
+	PrintMemoryUsage();
+	return 0;
+}
+
+// Packs every PNG in Sprites/ into one file for --pack
+int MakeSpritePack(const std::string& sFile) {
+	olc::ResourcePack pack;
+	int files = 0;
+	for (auto& entry : _gfs::directory_iterator("./Sprites")) {
+		if (entry.path().extension() != ".png")
+			continue;
+		if (pack.AddFile(entry.path().string()))
+			++files;
+	}
+	if (!pack.SavePack(sFile, "")) {
+		printf("Cannot write %s\n", sFile.c_str());
+		return 1;
+	}
+	printf("Packed %d sprites into %s\n", files, sFile.c_str());
+	return 0;
+}
+
+// Set from the command line, see main()
+struct AppOptions {
+	std::string sRecordFile;
+	std::string sPlayFile;
+	std::string sCaptureFile;
+	std::string sPackFile;
+	std::string sMetricsFile;
+	// Quit after this many frames, 0 runs until escape or the end of playback
+	int nFrameLimit = 0;
+	bool cohortDemand = false;
+	int nDemandPerHour = 0;
+	// Simulation ticks per second, 0 ticks once per frame
+	int nTickRate = 0;
+};
+
+class App : public olc::PixelGameEngine
+{
+	World world;
+	SessionRecorder recorder;
+	SessionPlayer player;
+	MetricsExporter metrics;
+	AppOptions options;
+	olc::ResourcePack pack;
+	int nFrames = 0;
+	std::chrono::steady_clock::time_point tpStart;
+
+	olc::Decal* decDeifi = nullptr;
+	olc::Decal* decEngel = nullptr;
+	olc::Decal* decStation = nullptr;
+	olc::Decal* decTrain = nullptr;
+	olc::Decal* decPassenger = nullptr;
+	olc::Decal* decBlockade = nullptr;
+	olc::Decal* decBlackBox = nullptr;
+	// File behind every decal, to tell which one could not be loaded
+	std::vector<std::pair<olc::Decal*, std::string>> decalFiles;
+
+	bool pauseGame = false;
+
+	// Fast forward runs several ticks per presented frame and only draws the
+	// last one. The number of ticks adapts so the game keeps targetFps.
+	static constexpr double targetFps = 30.0;
+	static constexpr int maxTicksPerFrame = 100000;
+	bool fastForward = false;
+	int ticksPerFrame = 1;
+	double tickCost = 0.0;	// Smoothed seconds per simulated tick
+	double lastSimTime = 0.0;
+	int timeShown = -1;
+	int64_t scoreShown = -1;
+	int bombsShown = -1;
+
+	// Rails and station bodies live on their own layer below layer 0, which
+	// is drawn and uploaded once, the network never changes during a game
+	uint32_t networkLayer = 0;
+
+	// Where commuters lose their time, on a layer between layer 0 and the
+	// network that is drawn again at most every heatmapFrames frames
+	static constexpr int heatmapFrames = 15;
+	uint32_t heatmapLayer = 0;
+	bool showHeatmap = false;
+	int heatmapShown = -1;
+	int heatmapWait = 0;	// Frames until it may be drawn again
+
+	// With a tick rate the simulation keeps its own clock. Frames then show
+	// the world between the state before the last tick and the current one,
+	// by how far they are into the next tick.
+	double tickDebt = 0.0;	// Ticks owed, the fraction is how far into the next we are
+	uint8_t pendingInput = 0;	// Keys seen by frames that ran no tick
+	float tickFraction = 1.f;	// 1 shows the current state
+	struct Snapshot {
+		std::vector<olc::vf2d> trains;	// By train id
+		std::vector<float> trainAngles;
+		std::vector<bool> inService;
+		std::vector<olc::vf2d> reps;
+		olc::vf2d deifi;
+	} previous;
+
+	// Heap per MemoryTag in the bottom left corner, updated once a second
+	bool showMemory = false;
+	std::chrono::steady_clock::time_point tpMemoryShown;
+	int64_t nAllocationsShown[MEM_TAG_COUNT] = {};
+public:
+	App(const AppOptions& options = AppOptions()) : options(options)
 	{
-		if (GetKey(olc::Key::O).bHeld) {
-			DrawRotatedDecal(olc::vi2d{ myDeifi.pos.first, myDeifi.pos.second }, myDeifi.decal, graph.globalTime % 360,
-				{ 10.f,10.f }, { 2.f,2.f });
+		sAppName = "Trains";
+	}
+
+	bool OnUserCreate() override
+	{
+		// Sprites decode on the worker threads while the world is built
+		if (!LoadDecals())
+			return false;
+
+		SessionHeader header;
+		header.width = ScreenWidth();
+		header.height = ScreenHeight();
+		header.cohortDemand = options.cohortDemand;
+		header.demandPerHour = options.nDemandPerHour;
+		if (!options.sPlayFile.empty()) {
+			// A recording plays in the world it was recorded in
+			if (!player.Open(options.sPlayFile)) {
+				printf("%s is not a session recording of this version\n", options.sPlayFile.c_str());
+				return false;
+			}
+			header = player.header;
 		}
-		if (GetKey(olc::Key::ESCAPE).bPressed) {
+		world = World(header.width, header.height, header.seed, header.cohortDemand, header.demandPerHour);
+		world.graph.jobs = &GetJobSystem();
+
+		FinishLoading();
+		for (auto& [decal, file] : decalFiles) {
+			if (decal->sprite != nullptr) continue;
+			if (options.sPackFile.empty()) printf("Cannot load %s\n", file.c_str());
+			else printf("Cannot load %s from %s\n", file.c_str(), options.sPackFile.c_str());
 			return false;
 		}
-		if (GetKey(olc::Key::ENTER).bPressed) {
-			int a = 1;
+
+		if (!options.sRecordFile.empty() && !recorder.Open(options.sRecordFile, header))
+			return false;
+		if (!options.sMetricsFile.empty() && !metrics.Start(options.sMetricsFile)) {
+			printf("Cannot write metrics to %s\n", options.sMetricsFile.c_str());
+			return false;
 		}
-		if (GetKey(olc::Key::LEFT).bHeld) {
-			MoveDeifi({ -5,0 });
+		if (!options.sCaptureFile.empty()) {
+			bool video = options.sCaptureFile.size() > 4 && options.sCaptureFile.compare(options.sCaptureFile.size() - 4, 4, ".y4m") == 0;
+			if (StartCapture(options.sCaptureFile, video ? olc::FrameCapture::Y4M : olc::FrameCapture::PNG_SEQUENCE) != olc::OK) {
+				printf("Cannot capture to %s\n", options.sCaptureFile.c_str());
+				return false;
+			}
 		}
-		if (GetKey(olc::Key::RIGHT).bHeld) {
-			MoveDeifi({ 5,0 });
+
+		Clear(olc::BLANK);
+		DrawInstructions();
+
+		DrawString(10, 10, "Score: ", olc::RED, 2);
+		DrawString(10, 40, "Time: ", olc::RED, 2);
+		DrawString(10, 70, "Blocks: ", olc::RED, 2);
+
+		heatmapLayer = CreateLayer();
+		networkLayer = CreateLayer();
+		EnableLayer(networkLayer, true);
+		DrawNetwork();
+		DrawAllTrains();
+		DrawObject(DeifiShown(), decDeifi, olc::vf2d{ 2.f,1.5f });
+		for (int i = 0; i < world.mvvReps.size(); ++i) DrawObject(RepShown(i), decEngel);
+		// Frames before the first tick interpolate from where things start
+		TakeSnapshot();
+
+		tpStart = std::chrono::steady_clock::now();
+		return true;
+	}
+
+	bool OnUserUpdate(float fElapsedTime) override
+	{
+		uint8_t input = ReadUserInput();
+		if (GetKey(olc::Key::F).bPressed) {
+			fastForward = !fastForward;
+			ticksPerFrame = 1;
+			lastSimTime = 0.0;
 		}
-		if (GetKey(olc::Key::UP).bHeld) {
-			MoveDeifi({ 0,-5 });
+		if (GetKey(olc::Key::H).bPressed) {
+			showHeatmap = !showHeatmap;
+			EnableLayer(heatmapLayer, showHeatmap);
+			heatmapWait = 0;
 		}
-		if (GetKey(olc::Key::DOWN).bHeld) {
-			MoveDeifi({ 0,5 });
+
+		int nTicks = 1;
+		bool interpolate = !fastForward && options.nTickRate > 0;
+		if (fastForward) {
+			nTicks = ticksPerFrame;
 		}
-		if (GetKey(olc::Key::SPACE).bPressed && myDeifi.nBombs && dist(myDeifi.pos, mvvRep.pos) > 20) {
-			//--myDeifi.nBombs;
-			graph.devilishBlockade.push_back(new DevilishBlockade(myDeifi.pos));
-			mvvRep.queueOfDetonations.push_back(myDeifi.pos);
+		else if (options.nTickRate > 0) {
+			// After a stall only catch up a quarter second, the rest is dropped
+			tickDebt = std::min(tickDebt + fElapsedTime * options.nTickRate, std::max(1.0, options.nTickRate / 4.0));
+			nTicks = (int)tickDebt;
+			tickDebt -= nTicks;
 		}
-		if (GetKey(olc::Key::DEL).bPressed) {
-			for (auto& train : graph.trains) {
-				if (train.blockade) {
-					delete train.blockade->decal;
-					train.blockade->decal = new olc::Decal(new olc::Sprite("./Sprites/BlackBox.png"));
-					train.blockade->pos = std::pair<int, int>{ 0,0 };
+		pendingInput |= input;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < nTicks; ++i) {
+			// Key presses belong to the first tick, the skipped ones get no input
+			uint8_t tickInput = i == 0 ? pendingInput : 0;
+			if (interpolate && i == nTicks - 1) TakeSnapshot();
+			uint32_t expected = 0;
+			if (player.ifs.is_open() && !player.Next(tickInput, expected))
+				return false; // Playback is over
+			bool running = world.Step(tickInput);
+			if (metrics.IsRunning()) metrics.Push(world.Metrics());
+			// The checksum walks the whole world, only sessions need it
+			if (recorder.ofs.is_open() || player.ifs.is_open()) {
+				uint32_t checksum = world.Checksum();
+				recorder.Record(tickInput, checksum);
+				if (player.ifs.is_open() && checksum != expected) {
+					printf("Playback diverged at tick %d\n", world.graph.globalTime);
+					return false;
 				}
 			}
+			if (!running)
+				return false;
+		}
+		if (nTicks) pendingInput = 0;
+		tickFraction = interpolate ? (float)tickDebt : 1.f;
+		if (fastForward) {
+			std::chrono::duration<double> simTime = std::chrono::steady_clock::now() - start;
+			AdjustTicksPerFrame(nTicks, simTime.count(), fElapsedTime);
+		}
+
+		if (showHeatmap) {
+			if (heatmapWait > 0) --heatmapWait;
+			else if (world.graph.delays.version != heatmapShown) DrawHeatmap();
+		}
+		DisplayData();
+		if (GetKey(olc::Key::M).bPressed) {
+			showMemory = !showMemory;
+			FillRect(10, memoryPanelTop(), 300, 10 * (MEM_TAG_COUNT + 1), olc::BLANK);
+			tpMemoryShown = std::chrono::steady_clock::time_point();
+		}
+		if (showMemory) DisplayMemory();
+
+		if (input & IN_SPIN) {
+			DrawRotatedDecal(DeifiShown(), decDeifi, world.graph.globalTime % 360,
+				{ 10.f,10.f }, { 2.f,2.f });
+		}
+		if (input & (IN_LEFT | IN_RIGHT | IN_UP | IN_DOWN)) {
+			DrawObject(DeifiShown(), decDeifi);
+		}
+
+		for (auto& blockade : world.graph.devilishBlockade) {
+			DrawBlockade(blockade.get());
 		}
+
+		DrawObject(DeifiShown(), decDeifi, olc::vf2d{ 2.f,1.5f }, olc::Pixel(std::min(255, 80 + 2 * (int)std::min<int64_t>(world.graph.score, 255)), 100, 150));
+		for (int i = 0; i < world.mvvReps.size(); ++i) DrawObject(RepShown(i), decEngel);
+		DrawAllTrains();
+
+		for (auto& station : world.graph.stations) DrawWaitingPassengers(station);
+
+		return !options.nFrameLimit || ++nFrames < options.nFrameLimit;
+	}
+
+	bool OnUserDestroy() override
+	{
+#if defined(OLC_PLATFORM_HEADLESS)
+		// Frame rate for render benchmarks and a hash of the final frame to
+		// compare against a golden one
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - tpStart;
+		olc::Sprite* frame = GetFrameBuffer();
+		uint32_t hash = 2166136261u;
+		for (int i = 0; i < frame->width * frame->height; ++i) {
+			hash = (hash ^ frame->pColData[i].n) * 16777619u;
+		}
+		printf("Rendered %d frames in %.3fs (%.0f frames/s), last frame %08x\n", nFrames, elapsed.count(),
+			elapsed.count() > 0 ? nFrames / elapsed.count() : 0.0, hash);
+#endif
+		// Textures can only be deleted while the renderer is still there
+		for (olc::Decal* decal : { decDeifi, decEngel, decStation, decTrain, decPassenger, decBlockade, decBlackBox }) {
+			if (decal == nullptr) continue;
+			delete decal->sprite;
+			delete decal;
+		}
+		PrintMemoryUsage();
 		return true;
 	}
 
-	void MoveMvvRep() {
-		if (!mvvRep.queueOfDetonations.empty() && mvvRep.Move() && mvvRep.removeBlockade()) {
-			for (auto& train : graph.trains) {
-				if (train.blockade && train.blockade->pos == mvvRep.queueOfDetonations[0]) {
-					train.blockade->pos = std::pair<int, int>{ ScreenWidth() ,ScreenHeight() };
-					delete train.blockade->decal;
-					train.blockade->decal = nullptr;
-				}
+	bool LoadDecals() {
+		// The loading jobs run under the same tag
+		olc::AllocationScope scope(MEM_ASSETS);
+		// From the pack the sprites are decoded straight out of the mapped file
+		olc::ResourcePack* from = nullptr;
+		if (!options.sPackFile.empty()) {
+			if (!pack.LoadPack(options.sPackFile, "")) {
+				printf("%s is not a sprite pack\n", options.sPackFile.c_str());
+				return false;
 			}
-			graph.devilishBlockade.erase(
-				std::remove_if(
-					graph.devilishBlockade.begin(), graph.devilishBlockade.end(),
-					[&](auto& det) {return det->pos == mvvRep.queueOfDetonations[0];}
-				),
-				graph.devilishBlockade.end()
-			);
+			from = &pack;
+		}
+		// Otherwise decoded copies next to the PNGs skip decoding next time
+		SetSpriteCache(true);
+		auto load = [&](const char* file) {
+			olc::Decal* decal = LoadDecalAsync(file, from);
+			decalFiles.emplace_back(decal, file);
+			return decal;
+		};
+		decDeifi = load("./Sprites/Deifi.png");
+		decEngel = load("./Sprites/Engel.png");
+		decStation = load("./Sprites/Station.png");
+		decTrain = load("./Sprites/SBahn.png");
+		decPassenger = load("./Sprites/Passenger.png");
+		decBlockade = load("./Sprites/Blockade.png");
+		decBlackBox = load("./Sprites/BlackBox.png");
+		return true;
+	}
+
+	void DrawInstructions() {
+		DrawString(ScreenWidth() / 2 - 50, 20, "Press arrow keys to Move");
+		DrawString(ScreenWidth() / 2 - 50, 40, "Press space to setup blockade");
+		DrawString(ScreenWidth() / 2 - 50, 60, "Press F to fast forward");
+		DrawString(ScreenWidth() / 2 - 50, 80, "Press H to show delays");
+		DrawString(ScreenWidth() / 2 - 50, 100, "Press M to show memory");
+		DrawString(ScreenWidth() / 2 - 50, 120, "Press escape to exit");
+	}
+
+	// Only what changed is drawn again, every pixel drawn means layer 0 is
+	// uploaded again that frame
+	void DisplayData() {
+		if (world.graph.score != scoreShown) {
+			scoreShown = world.graph.score;
+			FillRect(110, 10, 200, 30, olc::BLANK);
+			DrawString(110, 10, std::to_string(world.graph.score), olc::RED, 2);
+		}
+		// Several ticks may have passed since the last frame
+		if (world.graph.globalTime / 10 != timeShown) {
+			timeShown = world.graph.globalTime / 10;
+			FillRect(110, 40, 200, 30, olc::BLANK);
+			DrawString(110, 40, world.graph.convertGameTime(), olc::RED, 2);
+			if (fastForward) DrawString(110, 56, "x" + std::to_string(ticksPerFrame), olc::RED);
+		}
+		if (world.myDeifi.nBombs != bombsShown) {
+			bombsShown = world.myDeifi.nBombs;
+			FillRect(110, 70, 200, 30, olc::BLANK);
+			DrawString(110, 70, std::to_string(world.myDeifi.nBombs), olc::RED, 2);
+		}
+	}
+
+	int memoryPanelTop() {
+		return ScreenHeight() - 10 - 10 * (MEM_TAG_COUNT + 1);
+	}
+
+	void DisplayMemory() {
+		auto now = std::chrono::steady_clock::now();
+		std::chrono::duration<double> elapsed = now - tpMemoryShown;
+		bool first = tpMemoryShown == std::chrono::steady_clock::time_point();
+		if (!first && elapsed.count() < 1.0) return;
+		tpMemoryShown = now;
+		int y = memoryPanelTop();
+		FillRect(10, y, 300, 10 * (MEM_TAG_COUNT + 1), olc::BLANK);
+		DrawString(10, y, "heap         live KB   allocs/s", olc::RED);
+		for (int tag = 0; tag < MEM_TAG_COUNT; ++tag) {
+			olc::Allocations::Stats stats = olc::Allocations::Get(tag);
+			std::string rate = first ? "-" : std::to_string(int64_t((stats.nAllocations - nAllocationsShown[tag]) / elapsed.count()));
+			nAllocationsShown[tag] = stats.nAllocations;
+			char line[64];
+			snprintf(line, sizeof(line), "%-10s %9lld %10s", memoryTagNames[tag], (long long)(stats.nLiveBytes / 1024), rate.c_str());
+			DrawString(10, y + 10 * (tag + 1), line, olc::RED);
+		}
+	}
+
+	// fElapsedTime is the whole previous frame, what it did not spend on
+	// simulating went into drawing and presenting. Whatever is left of the
+	// frame budget is filled with ticks, changing by at most a factor of two
+	// per frame so a single slow frame doesn't make the speed jump around.
+	void AdjustTicksPerFrame(int nTicks, double simTime, float fElapsedTime) {
+		double overhead = std::max(0.0, fElapsedTime - lastSimTime);
+		lastSimTime = simTime;
+		double cost = simTime / nTicks;
+		tickCost = tickCost > 0.0 ? 0.9 * tickCost + 0.1 * cost : cost;
+
+		double budget = 1.0 / targetFps - overhead;
+		int wanted = tickCost > 0.0 ? int(std::min(budget / tickCost, double(maxTicksPerFrame))) : 2 * ticksPerFrame;
+		ticksPerFrame = std::clamp(wanted, std::max(1, ticksPerFrame / 2), std::min(maxTicksPerFrame, 2 * ticksPerFrame));
+	}
 
-			mvvRep.eraseFirstDetonation();
+	uint8_t ReadUserInput()
+	{
+		uint8_t input = 0;
+		if (GetKey(olc::Key::O).bHeld) input |= IN_SPIN;
+		if (GetKey(olc::Key::ESCAPE).bPressed) input |= IN_QUIT;
+		if (GetKey(olc::Key::LEFT).bHeld) input |= IN_LEFT;
+		if (GetKey(olc::Key::RIGHT).bHeld) input |= IN_RIGHT;
+		if (GetKey(olc::Key::UP).bHeld) input |= IN_UP;
+		if (GetKey(olc::Key::DOWN).bHeld) input |= IN_DOWN;
+		if (GetKey(olc::Key::SPACE).bPressed) input |= IN_BLOCKADE;
+		if (GetKey(olc::Key::DEL).bPressed) input |= IN_DEFUSE;
+		return input;
+	}
 
+	void DrawNetwork() {
+		SetDrawTarget(networkLayer);
+		Clear(olc::BLANK);
+		DrawGraphOfStations();
+		SetPixelMode(olc::Pixel::ALPHA);
+		for (auto& station : world.graph.stations) DrawStationBody(station);
+		SetPixelMode(olc::Pixel::NORMAL);
+		SetDrawTarget(nullptr);
+	}
+
+	// Green where commuters lose little time up to red where they lose the
+	// most, track and stations each scaled to their own worst
+	static olc::Pixel HeatColour(int64_t delay, int64_t worst) {
+		float t = sqrt(float(delay) / worst);
+		return olc::Pixel(uint8_t(255 * std::min(1.f, 2.f * t)), uint8_t(255 * std::min(1.f, 2.f - 2.f * t)), 0, 160);
+	}
+
+	void DrawHeatmap() {
+		heatmapShown = world.graph.delays.version;
+		heatmapWait = heatmapFrames;
+		const DelayHeatmap& delays = world.graph.delays;
+		SetDrawTarget(heatmapLayer);
+		Clear(olc::BLANK);
+		// The band between the two rails of a segment
+		for (int i = 0; i < delays.segments.size(); ++i) {
+			if (!delays.segments[i]) continue;
+			olc::Pixel colour = HeatColour(delays.segments[i], delays.maxSegment);
+			Station& a = world.graph.stations[delays.segmentEnds[i].first];
+			Station& b = world.graph.stations[delays.segmentEnds[i].second];
+			olc::vi2d a1{ a.lanePosition(1).first, a.lanePosition(1).second };
+			olc::vi2d a2{ a.lanePosition(-1).first, a.lanePosition(-1).second };
+			olc::vi2d b1{ b.lanePosition(1).first, b.lanePosition(1).second };
+			olc::vi2d b2{ b.lanePosition(-1).first, b.lanePosition(-1).second };
+			FillTriangle(a1, b1, b2, colour);
+			FillTriangle(a1, b2, a2, colour);
+		}
+		for (int i = 0; i < delays.stations.size(); ++i) {
+			if (!delays.stations[i]) continue;
+			Station& station = world.graph.stations[i];
+			FillCircle(station.pos.first, station.pos.second, 12, HeatColour(delays.stations[i], delays.maxStation));
 		}
+		SetDrawTarget(nullptr);
 	}
 
 	void DrawGraphOfStations() {
 		// Draw Rails
-		for (auto& line : graph.lines) {
-			for (int i = 1; i < line.size(); ++i) {
-				std::pair<int, int> pos1 = graph.stations[line[i]].lanePosition(1);
-				std::pair<int, int> pos2 = graph.stations[line[i - 1]].lanePosition(1);
+		for (auto& line : world.graph.lines) {
+			const std::vector<int>& stops = line.stops;
+			for (int i = 1; i < stops.size(); ++i) {
+				std::pair<int, int> pos1 = world.graph.stations[stops[i]].lanePosition(1);
+				std::pair<int, int> pos2 = world.graph.stations[stops[i - 1]].lanePosition(1);
 				DrawLine(pos1.first, pos1.second, pos2.first, pos2.second, olc::WHITE);
 
-				pos1 = graph.stations[line[i]].lanePosition(-1);
-				pos2 = graph.stations[line[i - 1]].lanePosition(-1);
+				pos1 = world.graph.stations[stops[i]].lanePosition(-1);
+				pos2 = world.graph.stations[stops[i - 1]].lanePosition(-1);
 				DrawLine(pos1.first, pos1.second, pos2.first, pos2.second, olc::WHITE);
 			}
 		}
 	}
 
-	void AddStation(std::pair<int, int>& pos, int id) {
-		graph.stations.emplace_back(id, pos);
-		//DrawStation(graph.stations.back());
+	void DrawObject(const olc::vf2d& pos, olc::Decal* decal, const olc::vf2d& scale = { 1.f,1.f }, const olc::Pixel& tint = olc::WHITE) {
+		DrawDecal(pos, decal, scale, tint);
 	}
 
-	template<typename T>
-	void DrawObject(T& obj, const olc::vf2d& scale = { 1.f,1.f }, const olc::Pixel& tint = olc::WHITE) {
-		DrawDecal(olc::vi2d{ obj.pos.first, obj.pos.second }, obj.decal, scale, tint);
+	static olc::vf2d ToScreen(const std::pair<int, int>& pos) {
+		return { (float)pos.first, (float)pos.second };
 	}
 
-	void DrawStation(Station& station) {
-		DrawRotatedDecal(olc::vf2d{ (float)station.pos.first, (float)station.pos.second },
-			station.decal, station.angle);
-		int cnt = 0;
-		for (auto& slave : graph.slaves) {
-			if (slave.pos == station.pos) {
-				if (slave.delayed == 30) {
-					delete slave.decal;
-					slave.decal = new olc::Decal(new olc::Sprite("./Sprites/PassengerRed.png"));
-				}
-				int x = 5 + 5 * cnt;
-				olc::vf2d vector{ station.pos.first + cos(station.angle) * x,
-								  station.pos.second + sin(station.angle) * x };
-				DrawRotatedDecal(vector, slave.decal, station.angle);
-				++cnt;
-			}
+	// Everything that moves, as it was before the last tick of the frame
+	void TakeSnapshot() {
+		previous.trains.resize(world.graph.trains.size());
+		previous.trainAngles.resize(world.graph.trains.size());
+		previous.inService.resize(world.graph.trains.size());
+		for (auto& train : world.graph.trains) {
+			previous.trains[train.id] = ToScreen(world.graph.trainPosition(train));
+			previous.trainAngles[train.id] = train.angle;
+			previous.inService[train.id] = train.state != retired;
+		}
+		previous.reps.resize(world.mvvReps.size());
+		for (int i = 0; i < world.mvvReps.size(); ++i) {
+			previous.reps[i] = ToScreen(world.mvvReps[i].pos);
 		}
+		previous.deifi = ToScreen(world.myDeifi.pos);
 	}
 
-	void DrawTrain(Train& train) {
-		auto color = (train.myPassengers.size() ? olc::Pixel(200, 200, 200) : olc::Pixel(100, 100, 150));
+	olc::vf2d Between(const olc::vf2d& before, const std::pair<int, int>& now) const {
+		return before + (ToScreen(now) - before) * tickFraction;
+	}
 
-		DrawRotatedDecal(
-			olc::vi2d{ train.pos.first, train.pos.second },
-			train.decal,
-			train.angle,
-			olc::vf2d{ (float)(train.decal->sprite->width) / 2.f, (float)(train.decal->sprite->height) / 2.f },
-			{ 1.2f,1.2f },
-			color
-		);
+	// Trains that just went into service have no earlier state to start from
+	bool HasPrevious(const Train& train) const {
+		return tickFraction < 1.f && train.id < previous.inService.size() && previous.inService[train.id];
 	}
 
-	void DrawAllTrains() {
-		for (auto& train : graph.trains) {
-			DrawTrain(train);
-			if (train.state == waiting) {
-				DrawStation(graph.stations[train.line[train.idx]]);
+	// A slot freed and reused within the same tick looks like a jump
+	static constexpr float maxTickDistance = 50.f;
+
+	olc::vf2d TrainShown(const Train& train) const {
+		std::pair<int, int> pos = world.graph.trainPosition(train);
+		if (!HasPrevious(train) || (ToScreen(pos) - previous.trains[train.id]).mag() > maxTickDistance) return ToScreen(pos);
+		return Between(previous.trains[train.id], pos);
+	}
+
+	// The short way round
+	float TrainAngleShown(const Train& train) const {
+		if (!HasPrevious(train) || (ToScreen(world.graph.trainPosition(train)) - previous.trains[train.id]).mag() > maxTickDistance) return train.angle;
+		float before = previous.trainAngles[train.id];
+		return before + remainder(train.angle - before, 2.f * 3.141f) * tickFraction;
+	}
+
+	olc::vf2d RepShown(int i) const {
+		const std::pair<int, int>& pos = world.mvvReps[i].pos;
+		return i < previous.reps.size() && tickFraction < 1.f ? Between(previous.reps[i], pos) : ToScreen(pos);
+	}
+
+	olc::vf2d DeifiShown() const {
+		return tickFraction < 1.f ? Between(previous.deifi, world.myDeifi.pos) : ToScreen(world.myDeifi.pos);
+	}
+
+	// Same placement as DrawRotatedDecal(station.pos, decStation, angle),
+	// but into the draw target: every pixel around the station is turned
+	// back into the sprite and sampled there
+	void DrawStationBody(Station& station) {
+		olc::Sprite* sprite = decStation->sprite;
+		float c = cos(station.angle);
+		float s = sin(station.angle);
+		int reach = (int)ceil(sqrt(float(sprite->width * sprite->width + sprite->height * sprite->height)));
+		for (int y = -reach; y <= reach; ++y) {
+			for (int x = -reach; x <= reach; ++x) {
+				float u = c * x + s * y;
+				float v = -s * x + c * y;
+				if (u < 0.f || v < 0.f || u >= sprite->width || v >= sprite->height) continue;
+				Draw(station.pos.first + x, station.pos.second + y, sprite->GetPixel((int)u, (int)v));
 			}
 		}
 	}
 
-	void MoveDeifi(std::pair<int, int> difference) {
-		addPairs(myDeifi.pos, difference);
-		DrawObject(myDeifi);
+	void DrawWaitingPassengers(Station& station) {
+		if (world.graph.cohortDemand) {
+			DrawWaitingCohorts(station);
+			return;
+		}
+		float c = cos(station.angle);
+		float s = sin(station.angle);
+		for (int cnt = 0; cnt < station.waitingPassengers.size(); ++cnt) {
+			Passenger& slave = world.graph.slaves[station.waitingPassengers[cnt]];
+			int x = 5 + 5 * cnt;
+			olc::vf2d vector{ station.pos.first + c * x, station.pos.second + s * x };
+			DrawRotatedDecal(vector, decPassenger, station.angle, { 0.f,0.f }, { 1.f,1.f },
+				slave.delayed >= 30 ? olc::RED : olc::WHITE);
+		}
 	}
 
-	void DrawBlockade(DevilishBlockade* blockade) {
-		DrawDecal(olc::vi2d{ blockade->pos.first, blockade->pos.second }, blockade->decal, { 2.f, 2.f });
+	// A crowd is shown by a few evenly spaced samples of it, each
+	// coloured like the cohort it falls into
+	static constexpr int maxCrowdIcons = 6;
+
+	void DrawWaitingCohorts(Station& station) {
+		int total = world.graph.waitingCommuters(station);
+		if (total == 0) return;
+		int icons = std::min(total, maxCrowdIcons);
+		float c = cos(station.angle);
+		float s = sin(station.angle);
+		auto cohort = station.waitingCohorts.begin();
+		int before = 0;
+		for (int cnt = 0; cnt < icons; ++cnt) {
+			int sample = (int)((int64_t)cnt * total / icons);
+			while (before + cohort->count <= sample) {
+				before += cohort->count;
+				++cohort;
+			}
+			int x = 5 + 5 * cnt;
+			olc::vf2d vector{ station.pos.first + c * x, station.pos.second + s * x };
+			DrawRotatedDecal(vector, decPassenger, station.angle, { 0.f,0.f }, { 1.f,1.f },
+				cohort->delayed >= 30 ? olc::RED : olc::WHITE);
+		}
 	}
 
-	void addPairs(std::pair<int, int>& current, std::pair<int, int>& toAdd) {
-		current.first += toAdd.first;
-		current.second += toAdd.second;
+	void DrawTrain(Train& train) {
+		auto color = (train.riding || train.load ? olc::Pixel(200, 200, 200) : olc::Pixel(100, 100, 150));
+		DrawRotatedDecal(
+			TrainShown(train),
+			decTrain,
+			TrainAngleShown(train),
+			olc::vf2d{ (float)(decTrain->sprite->width) / 2.f, (float)(decTrain->sprite->height) / 2.f },
+			{ 1.2f,1.2f },
+			color
+		);
 	}
 
-	int dist(std::pair<int, int>& pos1, std::pair<int, int> pos2) {
-		return (int)sqrt((pos1.first - pos2.first) * (pos1.first - pos2.first) +
-			(pos1.second - pos2.second) * (pos1.second - pos2.second));
+	void DrawAllTrains() {
+		for (auto& train : world.graph.trains) {
+			if (train.state != retired) DrawTrain(train);
+		}
+	}
+
+	void DrawBlockade(DevilishBlockade* blockade) {
+		DrawDecal(olc::vi2d{ blockade->pos.first, blockade->pos.second },
+			blockade->defused ? decBlackBox : decBlockade, { 2.f, 2.f });
 	}
 };
 
-int main()
+int main(int argc, char* argv[])
 {
-	App game;
-	if (game.Construct(1024, 730, 4, 4))
+	// --record <file> writes every tick's input and state checksum while playing
+	// --replay <file> runs a recording headless at full speed and verifies it
+	// --play <file>   shows a recording, drawn like a normal game
+	// --frames <n>    quits after n frames
+	// --capture <path> writes the frames to path.y4m or as PNGs into directory path
+	// --make-pack <file> packs the sprites into one file
+	// --pack <file>   loads the sprites from such a pack
+	// --cohorts       counts commuters in groups instead of one by one
+	// --demand <n>    n commuters an hour at the peak
+	// --tick-rate <n> runs n ticks a second whatever the frame rate, drawing
+	//                 moving things between ticks
+	// --metrics <file> writes queue lengths, train states, delays and more
+	//                 every game minute to file.csv, file.jsonl or file.prom
+	AppOptions options;
+	std::string sReplayFile;
+	for (int i = 1; i < argc; ++i) {
+		if (std::string(argv[i]) == "--cohorts") {
+			options.cohortDemand = true;
+			continue;
+		}
+		if (i + 1 == argc)
+			break;
+		if (std::string(argv[i]) == "--make-pack")
+			return MakeSpritePack(argv[i + 1]);
+		if (std::string(argv[i]) == "--replay")
+			sReplayFile = argv[++i];
+		else if (std::string(argv[i]) == "--record")
+			options.sRecordFile = argv[++i];
+		else if (std::string(argv[i]) == "--play")
+			options.sPlayFile = argv[++i];
+		else if (std::string(argv[i]) == "--frames")
+			options.nFrameLimit = atoi(argv[++i]);
+		else if (std::string(argv[i]) == "--capture")
+			options.sCaptureFile = argv[++i];
+		else if (std::string(argv[i]) == "--pack")
+			options.sPackFile = argv[++i];
+		else if (std::string(argv[i]) == "--demand")
+			options.nDemandPerHour = atoi(argv[++i]);
+		else if (std::string(argv[i]) == "--metrics")
+			options.sMetricsFile = argv[++i];
+		else if (std::string(argv[i]) == "--tick-rate")
+			options.nTickRate = atoi(argv[++i]);
+	}
+	if (!sReplayFile.empty())
+		return ReplaySession(sReplayFile, options.sMetricsFile);
+
+#if defined(OLC_PLATFORM_HEADLESS)
+	// Frames are composited in memory, one screen pixel per frame pixel
+	int nPixelSize = 1;
+#else
+	int nPixelSize = 4;
+#endif
+	App game(options);
+	if (game.Construct(1024, 730, nPixelSize, nPixelSize))
 		game.Start();
 	return 0;
 }
\ No newline at end of file
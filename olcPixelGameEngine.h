@@ -202,12 +202,19 @@ int main()
 #include <list>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <fstream>
 #include <map>
 #include <functional>
 #include <algorithm>
 #include <array>
 #include <cstring>
+#include <future>
+#include <new>
+#include <cstdlib>
 
 // O------------------------------------------------------------------------------O
 // | COMPILER CONFIGURATION ODDITIES                                              |
@@ -246,7 +253,17 @@ int main()
 #define UNUSED(x) (void)(x)
 
 
-#if !defined(OLC_GFX_OPENGL33) && !defined(OLC_GFX_DIRECTX10)
+// Without a display there is nothing to create a GPU context on, so a
+// headless build composites its frames in memory instead
+#if defined(OLC_PLATFORM_HEADLESS) && !defined(OLC_GFX_SOFTWARE)
+	#define OLC_GFX_SOFTWARE
+#endif
+
+#if defined(OLC_GFX_SOFTWARE) && !defined(OLC_PLATFORM_HEADLESS)
+	#error "The software renderer has no window to present to, use it with OLC_PLATFORM_HEADLESS"
+#endif
+
+#if !defined(OLC_GFX_OPENGL33) && !defined(OLC_GFX_DIRECTX10) && !defined(OLC_GFX_SOFTWARE)
 	#define OLC_GFX_OPENGL10
 #endif
 
@@ -388,10 +405,12 @@ namespace olc
 	// O------------------------------------------------------------------------------O
 	// | olc::ResourcePack - A virtual scrambled filesystem to pack your assets into  |
 	// O------------------------------------------------------------------------------O
+	// A read only view of one file inside a loaded pack, nothing is copied
 	struct ResourceBuffer : public std::streambuf
 	{
-		ResourceBuffer(std::ifstream &ifs, uint32_t offset, uint32_t size);
-		std::vector<char> vMemory;
+		ResourceBuffer(const char* data, uint32_t size);
+		const char* pData = nullptr;
+		uint32_t nSize = 0;
 	};
 
 	class ResourcePack : public std::streambuf
@@ -402,18 +421,152 @@ namespace olc
 		bool AddFile(const std::string& sFile);
 		bool LoadPack(const std::string& sFile, const std::string& sKey);
 		bool SavePack(const std::string& sFile, const std::string& sKey);
+		// Views into the pack stay valid until it is destroyed and may be
+		// taken from several threads at once. Unknown files give an empty view.
 		ResourceBuffer GetFileBuffer(const std::string& sFile);
 		bool Loaded();
 	private:
 		struct sResourceFile { uint32_t nSize; uint32_t nOffset; };
 		std::map<std::string, sResourceFile> mapFiles;
-		std::ifstream baseFile;
+		// The whole pack file, memory mapped where the platform allows it
+		// and read in one go elsewhere
+		const char* pPackData = nullptr;
+		size_t nPackSize = 0;
+		std::vector<char> vPackFile;
+		void UnloadPack();
 		std::vector<char> scramble(const std::vector<char>& data, const std::string& key);
 		std::string makeposix(const std::string& path);
 	};
 
 
 
+	// O------------------------------------------------------------------------------O
+	// | olc::Allocations - Live heap memory per part of the application              |
+	// O------------------------------------------------------------------------------O
+	// With OLC_TRACK_ALLOCATIONS defined before the implementation, global new
+	// and delete count every block towards the tag of the allocating thread,
+	// and freeing a block takes it off the tag it was counted towards. Tags
+	// are small numbers the application gives meaning to, 0 is anything
+	// allocated outside an AllocationScope. Jobs run under the tag they were
+	// submitted with. Without OLC_TRACK_ALLOCATIONS all counts stay zero.
+	namespace Allocations
+	{
+		constexpr uint8_t nMaxTags = 16;
+		struct Stats
+		{
+			int64_t nLiveBytes = 0;
+			int64_t nLiveBlocks = 0;
+			int64_t nTotalBytes = 0;	// Ever allocated
+			int64_t nAllocations = 0;
+		};
+		Stats Get(uint8_t nTag);
+		uint8_t CurrentTag();
+		void SetTag(uint8_t nTag);
+		bool Enabled();
+	}
+
+	// Tags allocations made by this thread until it goes out of scope
+	class AllocationScope
+	{
+	public:
+		AllocationScope(uint8_t nTag) : nPrevious(Allocations::CurrentTag()) { Allocations::SetTag(nTag); }
+		~AllocationScope() { Allocations::SetTag(nPrevious); }
+		AllocationScope(const AllocationScope&) = delete;
+		AllocationScope& operator=(const AllocationScope&) = delete;
+	private:
+		uint8_t nPrevious;
+	};
+
+	// O------------------------------------------------------------------------------O
+	// | olc::JobSystem - A pool of worker threads that steal work from each other    |
+	// O------------------------------------------------------------------------------O
+	class JobSystem
+	{
+	public:
+		// Counts the unfinished jobs of a batch, see Submit() and Wait()
+		struct Counter { std::atomic<int32_t> nPending{ 0 }; };
+
+		// By default one worker per core, minus the thread that submits
+		JobSystem(int32_t nWorkers = -1);
+		~JobSystem();
+
+	public:
+		// Queues a job. A worker pushes to and pops from the back of its own
+		// deque, idle workers steal from the front of the others.
+		void Submit(std::function<void()> job, Counter* counter = nullptr);
+		// Runs queued jobs on the calling thread until the counter is zero,
+		// sleeping while there are none
+		void Wait(Counter& counter);
+		// Number of threads that run jobs, including the one that waits
+		int32_t ThreadCount() const;
+
+		// Calls f(i) for every i in [0, n) and returns once all calls finished,
+		// the calling thread does its share of the work
+		template<typename F>
+		void ParallelFor(int32_t n, F&& f, int32_t nGrain = 1)
+		{
+			int32_t nChunks = std::min(ThreadCount() * 4, (n + nGrain - 1) / std::max(nGrain, 1));
+			if (nChunks <= 1)
+			{
+				for (int32_t i = 0; i < n; i++) f(i);
+				return;
+			}
+			int32_t nChunk = (n + nChunks - 1) / nChunks;
+			Counter counter;
+			for (int32_t nBegin = nChunk; nBegin < n; nBegin += nChunk)
+			{
+				int32_t nEnd = std::min(n, nBegin + nChunk);
+				Submit([&f, nBegin, nEnd]() { for (int32_t i = nBegin; i < nEnd; i++) f(i); }, &counter);
+			}
+			for (int32_t i = 0; i < nChunk; i++) f(i);
+			Wait(counter);
+		}
+
+	private:
+		struct Job { std::function<void()> func; Counter* counter = nullptr; uint8_t nTag = 0; };
+		struct Queue { std::mutex mux; std::deque<Job> jobs; };
+		// Queue 0 is shared by all threads that are not workers
+		std::vector<std::unique_ptr<Queue>> vQueues;
+		std::vector<std::thread> vThreads;
+		std::atomic<bool> bRunning{ true };
+		std::atomic<int32_t> nQueued{ 0 };
+		std::mutex muxSleep;
+		std::condition_variable cvSleep;
+		// A worker knows its pool, so that it does not use its queue index
+		// with another pool it submits to
+		struct ThisThread { const JobSystem* pPool = nullptr; int32_t nQueue = 0; };
+		static thread_local ThisThread thisThread;
+
+		int32_t QueueOfThisThread() const;
+		bool RunOne(int32_t nQueue);
+		void WorkerThread(int32_t nQueue);
+	};
+
+	// O------------------------------------------------------------------------------O
+	// | olc::TaskGraph - Tasks that start once all the tasks they depend on finished |
+	// O------------------------------------------------------------------------------O
+	class TaskGraph
+	{
+	public:
+		uint32_t AddTask(std::function<void()> task);
+		// Task "after" will not start before task "before" has finished
+		void AddDependency(uint32_t before, uint32_t after);
+		// Runs every task once, returns when all are done
+		void Run(olc::JobSystem& jobs);
+		void Clear();
+
+	private:
+		struct Node
+		{
+			std::function<void()> task;
+			std::vector<uint32_t> vSuccessors;
+			int32_t nDependencies = 0;
+			std::atomic<int32_t> nRemaining{ 0 };
+		};
+		std::vector<std::unique_ptr<Node>> vNodes;
+		void Launch(olc::JobSystem& jobs, uint32_t node, olc::JobSystem::Counter& counter);
+	};
+
 	// O------------------------------------------------------------------------------O
 	// | olc::Sprite - An image represented by a 2D array of olc::Pixel               |
 	// O------------------------------------------------------------------------------O
@@ -429,6 +582,10 @@ namespace olc
 		olc::rcode LoadFromFile(const std::string& sImageFile, olc::ResourcePack *pack = nullptr);
 		olc::rcode LoadFromPGESprFile(const std::string& sImageFile, olc::ResourcePack *pack = nullptr);
 		olc::rcode SaveToPGESprFile(const std::string& sImageFile);
+		// Loads sImageFile from the decoded copy sImageFile.spr next to it,
+		// decoding the image and writing that copy when it is missing or
+		// older than the image
+		olc::rcode LoadFromFileCached(const std::string& sImageFile);
 
 	public:
 		int32_t width = 0;
@@ -465,6 +622,62 @@ namespace olc
 		olc::vf2d vUVScale = { 1.0f, 1.0f };
 	};
 
+	// O------------------------------------------------------------------------------O
+	// | olc::FrameCapture - Writes presented frames to disk on a background thread   |
+	// O------------------------------------------------------------------------------O
+	class FrameCapture
+	{
+	public:
+		enum Format { PNG_SEQUENCE, Y4M };
+
+		// sPath is a directory for PNG_SEQUENCE and a file for Y4M. Frames are
+		// taken at a fixed nFps of real time, so the capture plays back at the
+		// speed the game ran at.
+		FrameCapture(const std::string& sPath, Format format, int32_t width, int32_t height, uint32_t nFps, uint32_t nBuffers);
+		// Writes out every frame still queued
+		~FrameCapture();
+		bool IsOpen() const;
+
+		// Called by the engine once per frame, before it is presented. Copies
+		// the frame into a free buffer when a capture frame is due, and drops
+		// it rather than wait when all buffers are still being written.
+		void Frame(float fElapsedTime);
+
+	public:
+		uint32_t nWritten = 0;
+		uint32_t nDropped = 0;
+
+	private:
+		struct Buffer
+		{
+			std::unique_ptr<olc::Sprite> sprite;
+			bool bBottomUp = false;
+			uint32_t nRepeat = 1; // The game ran slower than nFps, show it longer
+		};
+		std::string sPath;
+		Format format;
+		uint32_t nFps;
+		bool bOpen = false;
+		double fTime = 0.0;
+		uint64_t nFramesDue = 0;
+		uint32_t nFileIndex = 0;
+		std::ofstream ofsVideo;
+		std::vector<uint8_t> vPlanes;
+
+		std::vector<Buffer> vBuffers;
+		std::deque<uint32_t> qFree;
+		std::deque<uint32_t> qFull;
+		std::mutex muxQueues;
+		std::condition_variable cvFull;
+		bool bStop = false;
+		std::thread thread;
+
+		void WriterThread();
+		void Write(Buffer& buffer);
+		bool WritePNG(const std::string& sFile, Buffer& buffer);
+		void WriteY4M(Buffer& buffer);
+	};
+
 	// O------------------------------------------------------------------------------O
 	// | Auxilliary components internal to engine                                     |
 	// O------------------------------------------------------------------------------O
@@ -494,6 +707,7 @@ namespace olc
 	class Renderer
 	{
 	public:
+		virtual ~Renderer() = default;
 		virtual void       PrepareDevice() = 0;
 		virtual olc::rcode CreateDevice(std::vector<void*> params, bool bFullScreen, bool bVSYNC) = 0;
 		virtual olc::rcode DestroyDevice() = 0;
@@ -507,12 +721,15 @@ namespace olc
 		virtual void       ApplyTexture(uint32_t id) = 0;
 		virtual void       UpdateViewport(const olc::vi2d& pos, const olc::vi2d& size) = 0;
 		virtual void       ClearBuffer(olc::Pixel p, bool bDepth) = 0;
+		// Copies the frame drawn so far, for renderers that can
+		virtual olc::rcode ReadFrame(olc::Sprite* spr, bool& bBottomUp) { return olc::FAIL; }
 		static olc::PixelGameEngine* ptrPGE;
 	};
 	
 	class Platform
 	{
 	public:
+		virtual ~Platform() = default;
 		virtual olc::rcode ApplicationStartUp() = 0;
 		virtual olc::rcode ApplicationCleanUp() = 0;
 		virtual olc::rcode ThreadStartUp() = 0;
@@ -582,6 +799,37 @@ namespace olc
 		void SetDrawTarget(Sprite *target);
 		// Gets the current Frames Per Second
 		uint32_t GetFPS();
+		// The worker pool shared by the engine and the application, submit
+		// parallel work here rather than starting threads of your own
+		olc::JobSystem& GetJobSystem();
+#if defined(OLC_GFX_SOFTWARE)
+		// The last presented frame, composited in memory
+		olc::Sprite* GetFrameBuffer();
+#endif
+
+	public: // Capture
+		// Writes every presented frame to a PNG sequence in the directory sPath
+		// or to the raw video file sPath, without holding up the frame loop
+		olc::rcode StartCapture(const std::string& sPath, olc::FrameCapture::Format format, uint32_t nFps = 30, uint32_t nBuffers = 8);
+		void StopCapture();
+		bool IsCapturing();
+
+	public: // Asset loading
+		// Decodes the image on the job system, the future holds nullptr if it
+		// could not be loaded. The caller owns the sprite.
+		std::future<olc::Sprite*> LoadSpriteAsync(const std::string& sImageFile, olc::ResourcePack* pack = nullptr);
+		// Sprites loaded from files afterwards go through
+		// olc::Sprite::LoadFromFileCached, off by default
+		void SetSpriteCache(bool bEnable);
+		// Returns at once. The decal draws nothing until its sprite is decoded,
+		// then it is uploaded at the start of the next frame. If the image can
+		// not be loaded its sprite stays nullptr, callers check that after
+		// FinishLoading(). The caller owns the decal and its sprite, as with
+		// new olc::Decal(new olc::Sprite()).
+		olc::Decal* LoadDecalAsync(const std::string& sImageFile, olc::ResourcePack* pack = nullptr);
+		// Waits for every decal still loading and uploads it
+		void FinishLoading();
+		bool IsLoading();
 
 	public: // CONFIGURATION ROUTINES
 		// Layer targeting functions
@@ -701,9 +949,16 @@ namespace olc
 		Sprite*     pDefaultDrawTarget    = nullptr;
 		std::vector<LayerDesc> vLayers;
 		uint8_t		nTargetLayer          = 0;
+		bool		bTargetIsLayer        = false;
 		uint32_t	nLastFPS              = 0;
 		std::function<olc::Pixel(const int x, const int y, const olc::Pixel&, const olc::Pixel&)> funcPixelMode;
 		std::chrono::time_point<std::chrono::system_clock> m_tp1, m_tp2;
+		std::unique_ptr<olc::JobSystem> pJobSystem;
+		std::unique_ptr<olc::FrameCapture> pCapture;
+		struct PendingDecal { olc::Decal* decal; std::future<olc::Sprite*> sprite; };
+		std::vector<PendingDecal> vPendingDecals;
+		olc::JobSystem::Counter loadCounter;
+		bool bSpriteCache = false;
 
 		// State of keyboard		
 		bool		pKeyNewState[256]{ 0 };
@@ -735,6 +990,7 @@ namespace olc
 		void olc_ConstructFontSheet();
 		void olc_CoreUpdate();
 		void olc_PrepareEngine();
+		void olc_UploadDecals(bool bWait);
 		void olc_UpdateMouseState(int32_t button, bool state);
 		void olc_UpdateKeyState(int32_t key, bool state);
 		void olc_UpdateMouseFocus(bool state);
@@ -793,6 +1049,13 @@ namespace olc
 // | olcPixelGameEngine INTERFACE IMPLEMENTATION (CORE)                           |
 // | Note: The core implementation is platform independent                        |
 // O------------------------------------------------------------------------------O
+#if defined(__linux__) || defined(__FreeBSD__)
+	#include <png.h> // olc::FrameCapture
+	#include <fcntl.h> // olc::ResourcePack
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
 namespace olc
 {
 	// O------------------------------------------------------------------------------O
@@ -894,6 +1157,45 @@ namespace olc
 		return olc::FAIL;
 	}
 
+	olc::rcode Sprite::LoadFromFileCached(const std::string& sImageFile)
+	{
+		const std::string sCacheFile = sImageFile + ".spr";
+		std::error_code ec;
+		auto tImage = _gfs::last_write_time(sImageFile, ec);
+		if (ec) return LoadFromFile(sImageFile);
+
+		auto tCache = _gfs::last_write_time(sCacheFile, ec);
+		if (!ec && tCache >= tImage)
+		{
+			std::ifstream ifs(sCacheFile, std::ifstream::binary);
+			int32_t w = 0, h = 0;
+			ifs.read((char*)&w, sizeof(int32_t));
+			ifs.read((char*)&h, sizeof(int32_t));
+			size_t nData = (size_t)w * (size_t)h * sizeof(uint32_t);
+			uintmax_t nFile = _gfs::file_size(sCacheFile, ec);
+			// A cache of the wrong size is ignored and written again
+			if (ifs && w > 0 && h > 0 && !ec && nFile == 2 * sizeof(int32_t) + nData)
+			{
+				delete[] pColData;
+				pColData = new Pixel[w * h];
+				width = w;
+				height = h;
+				if (ifs.read((char*)pColData, nData)) return olc::OK;
+			}
+		}
+
+		olc::rcode result = LoadFromFile(sImageFile);
+		if (result != olc::OK) return result;
+		// Written under another name first, so nobody loads half a file
+		const std::string sTempFile = sCacheFile + ".tmp";
+		if (SaveToPGESprFile(sTempFile) == olc::OK)
+		{
+			_gfs::rename(sTempFile, sCacheFile, ec);
+			if (ec) _gfs::remove(sTempFile, ec);
+		}
+		return olc::OK;
+	}
+
 	void Sprite::SetSampleMode(olc::Sprite::Mode mode)
 	{ modeSample = mode; }
 
@@ -1001,15 +1303,27 @@ namespace olc
 	//=============================================================
 	// Resource Packs - Allows you to store files in one large 
 	// scrambled file - Thanks MaGetzUb for debugging a null char in std::stringstream bug
-	ResourceBuffer::ResourceBuffer(std::ifstream& ifs, uint32_t offset, uint32_t size)
+	ResourceBuffer::ResourceBuffer(const char* data, uint32_t size) : pData(data), nSize(size)
 	{
-		vMemory.resize(size);
-		ifs.seekg(offset); ifs.read(vMemory.data(), vMemory.size());
-		setg(vMemory.data(), vMemory.data(), vMemory.data() + size);
+		// The stream only ever reads, the cast does not make it writable
+		char* p = const_cast<char*>(data);
+		setg(p, p, p + size);
 	}
 
 	ResourcePack::ResourcePack() { }
-	ResourcePack::~ResourcePack() { baseFile.close(); }
+	ResourcePack::~ResourcePack() { UnloadPack(); }
+
+	void ResourcePack::UnloadPack()
+	{
+	#if defined(__linux__) || defined(__FreeBSD__)
+		if (pPackData != nullptr && vPackFile.empty())
+			munmap((void*)pPackData, nPackSize);
+	#endif
+		pPackData = nullptr;
+		nPackSize = 0;
+		vPackFile.clear();
+		mapFiles.clear();
+	}
 
 	bool ResourcePack::AddFile(const std::string& sFile)
 	{
@@ -1028,21 +1342,52 @@ namespace olc
 
 	bool ResourcePack::LoadPack(const std::string& sFile, const std::string& sKey)
 	{
-		// Open the resource file
-		baseFile.open(sFile, std::ifstream::binary);
-		if (!baseFile.is_open()) return false;
+		UnloadPack();
+
+		// Map the resource file, files are handed out as views into it
+	#if defined(__linux__) || defined(__FreeBSD__)
+		int fd = open(sFile.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				pPackData = (const char*)p;
+				nPackSize = size_t(st.st_size);
+			}
+		}
+		close(fd);
+	#else
+		std::ifstream ifs(sFile, std::ifstream::binary | std::ifstream::ate);
+		if (ifs.is_open())
+		{
+			vPackFile.resize(size_t(ifs.tellg()));
+			ifs.seekg(0);
+			ifs.read(vPackFile.data(), vPackFile.size());
+			if (ifs && !vPackFile.empty())
+			{
+				pPackData = vPackFile.data();
+				nPackSize = vPackFile.size();
+			}
+		}
+	#endif
+		if (pPackData == nullptr) return false;
 
 		// 1) Read Scrambled index
 		uint32_t nIndexSize = 0;
-		baseFile.read((char*)&nIndexSize, sizeof(uint32_t));
-
-		std::vector<char> buffer(nIndexSize);
-		for (uint32_t j = 0; j < nIndexSize; j++)
-			buffer[j] = baseFile.get();
+		if (nPackSize < sizeof(uint32_t)) { UnloadPack(); return false; }
+		memcpy(&nIndexSize, pPackData, sizeof(uint32_t));
+		if (nIndexSize > nPackSize - sizeof(uint32_t)) { UnloadPack(); return false; }
 
+		std::vector<char> buffer(pPackData + sizeof(uint32_t), pPackData + sizeof(uint32_t) + nIndexSize);
 		std::vector<char> decoded = scramble(buffer, sKey);
 		size_t pos = 0;
-		auto read = [&decoded, &pos](char* dst, size_t size) {
+		// A wrong key gives garbage sizes, which must not read past the index
+		bool bCorrupt = false;
+		auto read = [&decoded, &pos, &bCorrupt](char* dst, size_t size) {
+			if (pos + size > decoded.size()) { bCorrupt = true; memset(dst, 0, size); return; }
 			memcpy((void*)dst, (const void*)(decoded.data() + pos), size);
 			pos += size;
 		};
@@ -1056,10 +1401,11 @@ namespace olc
 		// 2) Read Map
 		uint32_t nMapEntries = 0;
 		read((char*)&nMapEntries, sizeof(uint32_t));
-		for (uint32_t i = 0; i < nMapEntries; i++)
+		for (uint32_t i = 0; i < nMapEntries && !bCorrupt; i++)
 		{
 			uint32_t nFilePathSize = 0;
 			read((char*)&nFilePathSize, sizeof(uint32_t));
+			if (nFilePathSize > decoded.size() - pos) { bCorrupt = true; break; }
 
 			std::string sFileName(nFilePathSize, ' ');
 			for (uint32_t j = 0; j < nFilePathSize; j++)
@@ -1071,8 +1417,10 @@ namespace olc
 			mapFiles[sFileName] = e;
 		}
 
-		// Don't close base file! we will provide a stream
-		// pointer when the file is requested
+		// Nothing is read or decoded until a file is requested
+		for (auto& e : mapFiles)
+			bCorrupt |= size_t(e.second.nOffset) + e.second.nSize > nPackSize;
+		if (bCorrupt) { UnloadPack(); return false; }
 		return true;
 	}
 
@@ -1151,10 +1499,14 @@ namespace olc
 	}
 
 	ResourceBuffer ResourcePack::GetFileBuffer(const std::string& sFile)
-	{ return ResourceBuffer(baseFile, mapFiles[sFile].nOffset, mapFiles[sFile].nSize); }
+	{
+		auto file = mapFiles.find(makeposix(sFile));
+		if (pPackData == nullptr || file == mapFiles.end()) return ResourceBuffer(nullptr, 0);
+		return ResourceBuffer(pPackData + file->second.nOffset, file->second.nSize);
+	}
 
 	bool ResourcePack::Loaded()
-	{ return baseFile.is_open(); }
+	{ return pPackData != nullptr; }
 
 	std::vector<char> ResourcePack::scramble(const std::vector<char>& data, const std::string& key)
 	{
@@ -1172,6 +1524,397 @@ namespace olc
 		return o;
 	};
 
+	// O------------------------------------------------------------------------------O
+	// | olc::Allocations IMPLEMENTATION                                              |
+	// O------------------------------------------------------------------------------O
+	namespace Allocations
+	{
+		// One cache line per tag so threads busy with different parts of the
+		// application don't fight over the counters
+		struct alignas(64) Counters
+		{
+			std::atomic<int64_t> nLiveBytes{ 0 };
+			std::atomic<int64_t> nLiveBlocks{ 0 };
+			std::atomic<int64_t> nTotalBytes{ 0 };
+			std::atomic<int64_t> nAllocations{ 0 };
+		};
+		static Counters counters[nMaxTags];
+		static thread_local uint8_t nThreadTag = 0;
+
+		Stats Get(uint8_t nTag)
+		{
+			Counters& c = counters[nTag % nMaxTags];
+			return { c.nLiveBytes.load(std::memory_order_relaxed), c.nLiveBlocks.load(std::memory_order_relaxed),
+				c.nTotalBytes.load(std::memory_order_relaxed), c.nAllocations.load(std::memory_order_relaxed) };
+		}
+
+		uint8_t CurrentTag()
+		{ return nThreadTag; }
+
+		void SetTag(uint8_t nTag)
+		{ nThreadTag = nTag % nMaxTags; }
+
+		bool Enabled()
+		{
+#if defined(OLC_TRACK_ALLOCATIONS)
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		void Counted(uint8_t nTag, int64_t nBytes)
+		{
+			Counters& c = counters[nTag];
+			c.nLiveBytes.fetch_add(nBytes, std::memory_order_relaxed);
+			c.nLiveBlocks.fetch_add(1, std::memory_order_relaxed);
+			c.nTotalBytes.fetch_add(nBytes, std::memory_order_relaxed);
+			c.nAllocations.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void Uncounted(uint8_t nTag, int64_t nBytes)
+		{
+			Counters& c = counters[nTag];
+			c.nLiveBytes.fetch_sub(nBytes, std::memory_order_relaxed);
+			c.nLiveBlocks.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	// O------------------------------------------------------------------------------O
+	// | olc::JobSystem IMPLEMENTATION                                                |
+	// O------------------------------------------------------------------------------O
+	thread_local JobSystem::ThisThread JobSystem::thisThread;
+
+	JobSystem::JobSystem(int32_t nWorkers)
+	{
+		if (nWorkers < 0) nWorkers = std::max(int32_t(std::thread::hardware_concurrency()) - 1, 0);
+		for (int32_t i = 0; i <= nWorkers; i++)
+			vQueues.push_back(std::make_unique<Queue>());
+		for (int32_t i = 1; i <= nWorkers; i++)
+			vThreads.push_back(std::thread(&JobSystem::WorkerThread, this, i));
+	}
+
+	JobSystem::~JobSystem()
+	{
+		{
+			std::unique_lock<std::mutex> lock(muxSleep);
+			bRunning = false;
+		}
+		cvSleep.notify_all();
+		for (auto& t : vThreads) t.join();
+	}
+
+	int32_t JobSystem::ThreadCount() const
+	{ return int32_t(vThreads.size()) + 1; }
+
+	int32_t JobSystem::QueueOfThisThread() const
+	{ return thisThread.pPool == this ? thisThread.nQueue : 0; }
+
+	void JobSystem::Submit(std::function<void()> job, Counter* counter)
+	{
+		if (counter) counter->nPending++;
+		Queue& queue = *vQueues[QueueOfThisThread()];
+		{
+			std::unique_lock<std::mutex> lock(queue.mux);
+			queue.jobs.push_back({ std::move(job), counter, Allocations::CurrentTag() });
+		}
+		{
+			std::unique_lock<std::mutex> lock(muxSleep);
+			nQueued++;
+		}
+		cvSleep.notify_one();
+	}
+
+	void JobSystem::Wait(Counter& counter)
+	{
+		int32_t nQueue = QueueOfThisThread();
+		while (counter.nPending > 0)
+		{
+			if (RunOne(nQueue)) continue;
+			// The last job of the batch wakes us, as does any new job
+			std::unique_lock<std::mutex> lock(muxSleep);
+			cvSleep.wait(lock, [&] { return counter.nPending == 0 || nQueued > 0; });
+		}
+	}
+
+	bool JobSystem::RunOne(int32_t nQueue)
+	{
+		Job job;
+		bool bFound = false;
+		// Newest own job first, it is the most likely to still be in cache
+		{
+			std::unique_lock<std::mutex> lock(vQueues[nQueue]->mux);
+			if (!vQueues[nQueue]->jobs.empty())
+			{
+				job = std::move(vQueues[nQueue]->jobs.back());
+				vQueues[nQueue]->jobs.pop_back();
+				bFound = true;
+			}
+		}
+		// Otherwise steal the oldest job of somebody else
+		for (size_t i = 1; !bFound && i < vQueues.size(); i++)
+		{
+			Queue& victim = *vQueues[(nQueue + i) % vQueues.size()];
+			std::unique_lock<std::mutex> lock(victim.mux);
+			if (!victim.jobs.empty())
+			{
+				job = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+				bFound = true;
+			}
+		}
+		if (!bFound) return false;
+
+		nQueued--;
+		{
+			AllocationScope scope(job.nTag);
+			job.func();
+		}
+		if (job.counter && --job.counter->nPending == 0)
+		{
+			// Taking the lock makes sure a waiter is either asleep or sees zero
+			{ std::unique_lock<std::mutex> lock(muxSleep); }
+			cvSleep.notify_all();
+		}
+		return true;
+	}
+
+	void JobSystem::WorkerThread(int32_t nQueue)
+	{
+		thisThread = { this, nQueue };
+		while (bRunning)
+		{
+			if (RunOne(nQueue)) continue;
+			std::unique_lock<std::mutex> lock(muxSleep);
+			cvSleep.wait(lock, [&] { return !bRunning || nQueued > 0; });
+		}
+	}
+
+	// O------------------------------------------------------------------------------O
+	// | olc::TaskGraph IMPLEMENTATION                                                |
+	// O------------------------------------------------------------------------------O
+	uint32_t TaskGraph::AddTask(std::function<void()> task)
+	{
+		vNodes.push_back(std::make_unique<Node>());
+		vNodes.back()->task = std::move(task);
+		return uint32_t(vNodes.size() - 1);
+	}
+
+	void TaskGraph::AddDependency(uint32_t before, uint32_t after)
+	{
+		vNodes[before]->vSuccessors.push_back(after);
+		vNodes[after]->nDependencies++;
+	}
+
+	void TaskGraph::Clear()
+	{ vNodes.clear(); }
+
+	void TaskGraph::Run(olc::JobSystem& jobs)
+	{
+		for (auto& node : vNodes) node->nRemaining = node->nDependencies;
+		olc::JobSystem::Counter counter;
+		for (uint32_t i = 0; i < vNodes.size(); i++)
+			if (vNodes[i]->nDependencies == 0) Launch(jobs, i, counter);
+		jobs.Wait(counter);
+	}
+
+	void TaskGraph::Launch(olc::JobSystem& jobs, uint32_t node, olc::JobSystem::Counter& counter)
+	{
+		// Successors are submitted before this job counts as done, so the
+		// counter cannot drop to zero while there is still work left
+		jobs.Submit([this, &jobs, node, &counter]()
+		{
+			vNodes[node]->task();
+			for (uint32_t next : vNodes[node]->vSuccessors)
+				if (--vNodes[next]->nRemaining == 0) Launch(jobs, next, counter);
+		}, &counter);
+	}
+
+	// O------------------------------------------------------------------------------O
+	// | olc::FrameCapture IMPLEMENTATION                                             |
+	// O------------------------------------------------------------------------------O
+	FrameCapture::FrameCapture(const std::string& sPath, Format format, int32_t width, int32_t height, uint32_t nFps, uint32_t nBuffers)
+		: sPath(sPath), format(format), nFps(nFps)
+	{
+		if (format == PNG_SEQUENCE)
+		{
+		#if defined(__linux__) || defined(__FreeBSD__)
+			std::error_code ec;
+			_gfs::create_directories(sPath, ec);
+			bOpen = _gfs::is_directory(sPath, ec);
+		#endif
+		}
+		else
+		{
+			ofsVideo.open(sPath, std::ofstream::binary);
+			bOpen = ofsVideo.is_open();
+			if (bOpen)
+				ofsVideo << "YUV4MPEG2 W" << width << " H" << height << " F" << nFps << ":1 Ip A1:1 C444\n";
+		}
+		if (!bOpen) return;
+
+		// All memory is allocated up front, the frame loop never waits for it
+		for (uint32_t i = 0; i < nBuffers; i++)
+		{
+			vBuffers.push_back({ std::make_unique<olc::Sprite>(width, height) });
+			qFree.push_back(i);
+		}
+		thread = std::thread(&FrameCapture::WriterThread, this);
+	}
+
+	FrameCapture::~FrameCapture()
+	{
+		if (!bOpen) return;
+		{
+			std::unique_lock<std::mutex> lock(muxQueues);
+			bStop = true;
+		}
+		cvFull.notify_one();
+		thread.join();
+		if (nDropped > 0)
+			printf("NOTE: %u captured frames were dropped, the disk could not keep up\n", nDropped);
+	}
+
+	bool FrameCapture::IsOpen() const
+	{ return bOpen; }
+
+	void FrameCapture::Frame(float fElapsedTime)
+	{
+		if (!bOpen) return;
+		fTime += fElapsedTime;
+		uint64_t nDue = uint64_t(fTime * nFps) + 1;
+		if (nDue <= nFramesDue) return;
+		uint32_t nRepeat = uint32_t(nDue - nFramesDue);
+		nFramesDue = nDue;
+
+		uint32_t nBuffer;
+		{
+			std::unique_lock<std::mutex> lock(muxQueues);
+			if (qFree.empty())
+			{
+				nDropped += nRepeat;
+				return;
+			}
+			nBuffer = qFree.front();
+			qFree.pop_front();
+		}
+
+		Buffer& buffer = vBuffers[nBuffer];
+		buffer.nRepeat = nRepeat;
+		if (renderer->ReadFrame(buffer.sprite.get(), buffer.bBottomUp) != olc::OK)
+		{
+			std::unique_lock<std::mutex> lock(muxQueues);
+			qFree.push_back(nBuffer);
+			nDropped += nRepeat;
+			return;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(muxQueues);
+			qFull.push_back(nBuffer);
+		}
+		cvFull.notify_one();
+	}
+
+	void FrameCapture::WriterThread()
+	{
+		while (true)
+		{
+			uint32_t nBuffer;
+			{
+				std::unique_lock<std::mutex> lock(muxQueues);
+				cvFull.wait(lock, [&] { return bStop || !qFull.empty(); });
+				if (qFull.empty()) return; // Stopped and drained
+				nBuffer = qFull.front();
+				qFull.pop_front();
+			}
+			Write(vBuffers[nBuffer]);
+			{
+				std::unique_lock<std::mutex> lock(muxQueues);
+				qFree.push_back(nBuffer);
+			}
+		}
+	}
+
+	void FrameCapture::Write(Buffer& buffer)
+	{
+		if (format == PNG_SEQUENCE)
+		{
+			for (uint32_t i = 0; i < buffer.nRepeat; i++)
+			{
+				char sName[32];
+				snprintf(sName, sizeof(sName), "/frame_%06u.png", nFileIndex++);
+				if (WritePNG(sPath + sName, buffer)) nWritten++;
+			}
+		}
+		else
+		{
+			WriteY4M(buffer);
+		}
+	}
+
+	bool FrameCapture::WritePNG(const std::string& sFile, Buffer& buffer)
+	{
+	#if defined(__linux__) || defined(__FreeBSD__)
+		FILE* f = fopen(sFile.c_str(), "wb");
+		if (!f) return false;
+		png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+		png_infop info = png ? png_create_info_struct(png) : nullptr;
+		if (!info || setjmp(png_jmpbuf(png)))
+		{
+			png_destroy_write_struct(&png, &info);
+			fclose(f);
+			return false;
+		}
+		png_init_io(png, f);
+		// Favour speed, a capture has to keep up with the game
+		png_set_compression_level(png, 1);
+		olc::Sprite& spr = *buffer.sprite;
+		png_set_IHDR(png, info, spr.width, spr.height, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+			PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+		png_write_info(png, info);
+		for (int32_t y = 0; y < spr.height; y++)
+		{
+			int32_t row = buffer.bBottomUp ? spr.height - 1 - y : y;
+			png_write_row(png, (png_bytep)(spr.GetData() + row * spr.width));
+		}
+		png_write_end(png, nullptr);
+		png_destroy_write_struct(&png, &info);
+		fclose(f);
+		return true;
+	#else
+		return false;
+	#endif
+	}
+
+	// Full resolution chroma, BT.601 studio range
+	void FrameCapture::WriteY4M(Buffer& buffer)
+	{
+		olc::Sprite& spr = *buffer.sprite;
+		size_t nPlane = size_t(spr.width) * size_t(spr.height);
+		vPlanes.resize(nPlane * 3);
+		uint8_t* pY = vPlanes.data();
+		uint8_t* pU = pY + nPlane;
+		uint8_t* pV = pU + nPlane;
+		for (int32_t y = 0; y < spr.height; y++)
+		{
+			const olc::Pixel* src = spr.GetData() + (buffer.bBottomUp ? spr.height - 1 - y : y) * spr.width;
+			for (int32_t x = 0; x < spr.width; x++)
+			{
+				int32_t r = src[x].r, g = src[x].g, b = src[x].b;
+				*pY++ = uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+				*pU++ = uint8_t(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+				*pV++ = uint8_t(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+			}
+		}
+		for (uint32_t i = 0; i < buffer.nRepeat; i++)
+		{
+			ofsVideo << "FRAME\n";
+			ofsVideo.write((const char*)vPlanes.data(), vPlanes.size());
+			nWritten++;
+		}
+	}
+
 	// O------------------------------------------------------------------------------O
 	// | olc::PixelGameEngine IMPLEMENTATION                                          |
 	// O------------------------------------------------------------------------------O
@@ -1179,6 +1922,7 @@ namespace olc
 	{
 		sAppName = "Undefined";
 		olc::PGEX::pge = this;
+		pJobSystem = std::make_unique<olc::JobSystem>();
 
 		// Bring in relevant Platform & Rendering systems depending
 		// on compiler parameters
@@ -1254,11 +1998,13 @@ namespace olc
 		if (target)
 		{
 			pDrawTarget = target;
+			bTargetIsLayer = false;
 		}
 		else
 		{
 			nTargetLayer = 0;
 			pDrawTarget = vLayers[0].pDrawTarget;
+			bTargetIsLayer = true;
 		}
 	}
 
@@ -1269,6 +2015,7 @@ namespace olc
 			pDrawTarget = vLayers[layer].pDrawTarget;
 			vLayers[layer].bUpdate = true;
 			nTargetLayer = layer;
+			bTargetIsLayer = true;
 		}
 	}
 
@@ -1328,6 +2075,82 @@ namespace olc
 	uint32_t PixelGameEngine::GetFPS()
 	{ return nLastFPS; }
 
+	olc::JobSystem& PixelGameEngine::GetJobSystem()
+	{ return *pJobSystem; }
+
+	olc::rcode PixelGameEngine::StartCapture(const std::string& sPath, olc::FrameCapture::Format format, uint32_t nFps, uint32_t nBuffers)
+	{
+		pCapture = std::make_unique<olc::FrameCapture>(sPath, format, vViewSize.x, vViewSize.y, nFps, nBuffers);
+		if (pCapture->IsOpen()) return olc::OK;
+		pCapture.reset();
+		return olc::FAIL;
+	}
+
+	void PixelGameEngine::StopCapture()
+	{ pCapture.reset(); }
+
+	bool PixelGameEngine::IsCapturing()
+	{ return pCapture != nullptr; }
+
+	std::future<olc::Sprite*> PixelGameEngine::LoadSpriteAsync(const std::string& sImageFile, olc::ResourcePack* pack)
+	{
+		auto promise = std::make_shared<std::promise<olc::Sprite*>>();
+		std::future<olc::Sprite*> sprite = promise->get_future();
+		bool bCached = bSpriteCache && pack == nullptr;
+		pJobSystem->Submit([promise, sImageFile, pack, bCached]()
+		{
+			olc::Sprite* spr = new olc::Sprite();
+			olc::rcode result = bCached ? spr->LoadFromFileCached(sImageFile) : spr->LoadFromFile(sImageFile, pack);
+			if (result != olc::OK)
+			{
+				delete spr;
+				spr = nullptr;
+			}
+			promise->set_value(spr);
+		}, &loadCounter);
+		return sprite;
+	}
+
+	void PixelGameEngine::SetSpriteCache(bool bEnable)
+	{ bSpriteCache = bEnable; }
+
+	olc::Decal* PixelGameEngine::LoadDecalAsync(const std::string& sImageFile, olc::ResourcePack* pack)
+	{
+		olc::Decal* decal = new olc::Decal(nullptr);
+		vPendingDecals.push_back({ decal, LoadSpriteAsync(sImageFile, pack) });
+		return decal;
+	}
+
+	void PixelGameEngine::FinishLoading()
+	{ olc_UploadDecals(true); }
+
+	bool PixelGameEngine::IsLoading()
+	{ return !vPendingDecals.empty(); }
+
+	// Textures can only be created on the thread that owns the renderer
+	void PixelGameEngine::olc_UploadDecals(bool bWait)
+	{
+		if (vPendingDecals.empty()) return;
+		// Without workers nobody else would ever run the loading jobs
+		if (bWait || pJobSystem->ThreadCount() == 1) pJobSystem->Wait(loadCounter);
+
+		auto pending = vPendingDecals.begin();
+		for (auto& p : vPendingDecals)
+		{
+			if (p.sprite.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			{
+				*pending++ = std::move(p);
+				continue;
+			}
+			olc::Sprite* spr = p.sprite.get();
+			if (spr == nullptr) continue;
+			p.decal->sprite = spr;
+			p.decal->id = renderer->CreateTexture(spr->width, spr->height);
+			p.decal->Update();
+		}
+		vPendingDecals.erase(pending, vPendingDecals.end());
+	}
+
 	bool PixelGameEngine::IsFocused()
 	{ return bHasInputFocus; }
 
@@ -1359,6 +2182,7 @@ namespace olc
 	bool PixelGameEngine::Draw(int32_t x, int32_t y, Pixel p)
 	{
 		if (!pDrawTarget) return false;
+		if (bTargetIsLayer) vLayers[nTargetLayer].bUpdate = true;
 
 		if (nPixelMode == Pixel::NORMAL)
 		{
@@ -1540,6 +2364,7 @@ namespace olc
 		int pixels = GetDrawTargetWidth() * GetDrawTargetHeight();
 		Pixel* m = GetDrawTarget()->GetData();
 		for (int i = 0; i < pixels; i++) m[i] = p;
+		if (bTargetIsLayer) vLayers[nTargetLayer].bUpdate = true;
 	}
 
 	void PixelGameEngine::ClearBuffer(Pixel p, bool bDepth)
@@ -2135,6 +2960,8 @@ namespace olc
 			}
 		}
 
+		// Finish writing captured frames before the renderer goes away
+		StopCapture();
 		platform->ThreadCleanUp();
 	}
 
@@ -2204,6 +3031,8 @@ namespace olc
 
 		renderer->ClearBuffer(olc::BLACK, true);
 
+		olc_UploadDecals(false);
+
 		// Handle Frame Update
 		if (!OnUserUpdate(fElapsedTime))
 			bAtomActive = false;
@@ -2212,8 +3041,8 @@ namespace olc
 		renderer->UpdateViewport(vViewPos, vViewSize);
 		renderer->ClearBuffer(olc::BLACK, true);
 
-		// Layer 0 must always exist
-		vLayers[0].bUpdate = true;
+		// Layer 0 must always exist. Like every other layer it is only
+		// uploaded again when something was drawn into it.
 		vLayers[0].bShow = true;
 		renderer->PrepareDrawing();
 
@@ -2233,8 +3062,9 @@ namespace olc
 					renderer->DrawLayerQuad(layer->vOffset, layer->vScale, layer->tint);
 
 					// Display Decals in order for this layer
+					// Decals still loading have no texture yet
 					for (auto& decal : layer->vecDecalInstance)
-						renderer->DrawDecalQuad(decal);
+						if (decal.decal->id != -1) renderer->DrawDecalQuad(decal);
 					layer->vecDecalInstance.clear();
 				}
 				else
@@ -2245,6 +3075,8 @@ namespace olc
 			}
 		}
 
+		if (pCapture) pCapture->Frame(fElapsedTime);
+
 		// Present Graphics to screen
 		renderer->DisplayFrame();
 
@@ -2310,6 +3142,50 @@ namespace olc
 	olc::PixelGameEngine* olc::Renderer::ptrPGE = nullptr;
 };
 
+#if defined(OLC_TRACK_ALLOCATIONS)
+// Every block carries its size and tag in front of it. The header is as
+// large as the default new alignment so the block keeps that alignment.
+// Over-aligned new is left to the library and is not counted.
+namespace olc::Allocations
+{
+	struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Header { size_t nSize; uint8_t nTag; };
+
+	static void* Allocate(size_t nSize)
+	{
+		Header* h = (Header*)std::malloc(sizeof(Header) + nSize);
+		if (h == nullptr) return nullptr;
+		h->nSize = nSize;
+		h->nTag = nThreadTag;
+		Counted(h->nTag, int64_t(nSize));
+		return h + 1;
+	}
+
+	static void Free(void* p)
+	{
+		if (p == nullptr) return;
+		Header* h = (Header*)p - 1;
+		Uncounted(h->nTag, int64_t(h->nSize));
+		std::free(h);
+	}
+}
+
+void* operator new(size_t nSize)
+{
+	void* p = olc::Allocations::Allocate(nSize);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+void* operator new[](size_t nSize) { return operator new(nSize); }
+void* operator new(size_t nSize, const std::nothrow_t&) noexcept { return olc::Allocations::Allocate(nSize); }
+void* operator new[](size_t nSize, const std::nothrow_t&) noexcept { return olc::Allocations::Allocate(nSize); }
+void operator delete(void* p) noexcept { olc::Allocations::Free(p); }
+void operator delete[](void* p) noexcept { olc::Allocations::Free(p); }
+void operator delete(void* p, size_t) noexcept { olc::Allocations::Free(p); }
+void operator delete[](void* p, size_t) noexcept { olc::Allocations::Free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { olc::Allocations::Free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { olc::Allocations::Free(p); }
+#endif
+
 
 
 // O------------------------------------------------------------------------------O
@@ -2515,7 +3391,18 @@ namespace olc
 		void UpdateViewport(const olc::vi2d& pos, const olc::vi2d& size) override
 		{
 			glViewport(pos.x, pos.y, size.x, size.y);
+			vViewPos = pos;
 		}
+
+		olc::rcode ReadFrame(olc::Sprite* spr, bool& bBottomUp) override
+		{
+			glReadPixels(vViewPos.x, vViewPos.y, spr->width, spr->height, GL_RGBA, GL_UNSIGNED_BYTE, spr->GetData());
+			bBottomUp = true;
+			return olc::OK;
+		}
+
+	private:
+		olc::vi2d vViewPos = { 0, 0 };
 	};
 }
 #endif
@@ -2523,6 +3410,207 @@ namespace olc
 // | END RENDERER: OpenGL 1.0 (the original, the best...)                         |
 // O------------------------------------------------------------------------------O
 
+// O------------------------------------------------------------------------------O
+// | START RENDERER: Software (composites into memory, no GPU or display needed)  |
+// O------------------------------------------------------------------------------O
+#if defined(OLC_GFX_SOFTWARE)
+namespace olc
+{
+	class Renderer_Software : public olc::Renderer
+	{
+	private:
+		struct Texture
+		{
+			int32_t width = 0;
+			int32_t height = 0;
+			std::vector<olc::Pixel> data;
+		};
+		// Like in OpenGL id 0 is never handed out
+		std::vector<Texture> vTextures = std::vector<Texture>(1);
+		uint32_t nBoundTexture = 0;
+		// Drawn into the back buffer, DisplayFrame() swaps them
+		std::unique_ptr<olc::Sprite> pBackBuffer;
+		std::unique_ptr<olc::Sprite> pFrontBuffer;
+
+		// GL_NEAREST with GL_REPEAT
+		static int32_t TexelIndex(float u, int32_t size)
+		{
+			int32_t i = int32_t(std::floor(u * size)) % size;
+			return i < 0 ? i + size : i;
+		}
+
+		// GL_MODULATE
+		static olc::Pixel Modulate(const olc::Pixel& p, const olc::Pixel& tint)
+		{ return olc::Pixel(p.r * tint.r / 255, p.g * tint.g / 255, p.b * tint.b / 255, p.a * tint.a / 255); }
+
+		static olc::Pixel Sample(const Texture& tex, float u, float v, const olc::Pixel& tint)
+		{
+			if (tex.width == 0 || tex.height == 0) return olc::BLANK;
+			return Modulate(tex.data[TexelIndex(v, tex.height) * tex.width + TexelIndex(u, tex.width)], tint);
+		}
+
+		// glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA)
+		static void Blend(olc::Pixel& d, const olc::Pixel& s)
+		{
+			if (s.a == 255) { d = s; return; }
+			if (s.a == 0) return;
+			uint32_t a = s.a, c = 255 - s.a;
+			d = olc::Pixel((s.r * a + d.r * c) / 255, (s.g * a + d.g * c) / 255,
+				(s.b * a + d.b * c) / 255, (s.a * a + d.a * c) / 255);
+		}
+
+		// One triangle of a quad, (s, t, q) are interpolated across the
+		// screen and sampled at (s / q, t / q) just like glTexCoord4f does.
+		// Pixels on the edge a-c belong to the first triangle only.
+		void DrawTriangle(const olc::DecalInstance& decal, const olc::vf2d* p, int a, int b, int c, bool bSharedEdge)
+		{
+			const Texture& tex = vTextures[decal.decal->id];
+			olc::Sprite& frame = *pBackBuffer;
+			float area = (p[b].x - p[a].x) * (p[c].y - p[a].y) - (p[b].y - p[a].y) * (p[c].x - p[a].x);
+			if (area == 0.0f) return;
+
+			int32_t x0 = std::max(0, int32_t(std::floor(std::min({ p[a].x, p[b].x, p[c].x }))));
+			int32_t x1 = std::min(frame.width - 1, int32_t(std::ceil(std::max({ p[a].x, p[b].x, p[c].x }))));
+			int32_t y0 = std::max(0, int32_t(std::floor(std::min({ p[a].y, p[b].y, p[c].y }))));
+			int32_t y1 = std::min(frame.height - 1, int32_t(std::ceil(std::max({ p[a].y, p[b].y, p[c].y }))));
+
+			auto edge = [](const olc::vf2d& e0, const olc::vf2d& e1, float x, float y)
+			{ return (e1.x - e0.x) * (y - e0.y) - (e1.y - e0.y) * (x - e0.x); };
+
+			for (int32_t y = y0; y <= y1; y++)
+			{
+				for (int32_t x = x0; x <= x1; x++)
+				{
+					float px = x + 0.5f, py = y + 0.5f;
+					float wa = edge(p[b], p[c], px, py) / area;
+					float wb = edge(p[c], p[a], px, py) / area;
+					float wc = edge(p[a], p[b], px, py) / area;
+					if (wa < 0.0f || wc < 0.0f) continue;
+					if (bSharedEdge ? wb <= 0.0f : wb < 0.0f) continue;
+
+					float s = wa * decal.uv[a].x + wb * decal.uv[b].x + wc * decal.uv[c].x;
+					float t = wa * decal.uv[a].y + wb * decal.uv[b].y + wc * decal.uv[c].y;
+					float q = wa * decal.w[a] + wb * decal.w[b] + wc * decal.w[c];
+					if (q == 0.0f) continue;
+					Blend(frame.pColData[y * frame.width + x], Sample(tex, s / q, t / q, decal.tint));
+				}
+			}
+		}
+
+	public:
+		// The last frame handed to DisplayFrame()
+		olc::Sprite* GetFrameBuffer()
+		{ return pFrontBuffer.get(); }
+
+		void PrepareDevice() override
+		{ }
+
+		olc::rcode CreateDevice(std::vector<void*> params, bool bFullScreen, bool bVSYNC) override
+		{ return olc::rcode::OK; }
+
+		olc::rcode DestroyDevice() override
+		{ return olc::rcode::OK; }
+
+		void DisplayFrame() override
+		{ std::swap(pBackBuffer, pFrontBuffer); }
+
+		void PrepareDrawing() override
+		{ }
+
+		void DrawLayerQuad(const olc::vf2d& offset, const olc::vf2d& scale, const olc::Pixel tint) override
+		{
+			const Texture& tex = vTextures[nBoundTexture];
+			olc::Sprite& frame = *pBackBuffer;
+			if (tex.width == 0 || tex.height == 0) return;
+			// Texel columns are the same for every row
+			std::vector<int32_t> vColumns(frame.width);
+			for (int32_t x = 0; x < frame.width; x++)
+				vColumns[x] = TexelIndex((float(x) + 0.5f) / float(frame.width) * scale.x + offset.x, tex.width);
+			bool bTinted = tint != olc::WHITE;
+			// Every row on its own, so the rows are spread over the engine's workers
+			ptrPGE->GetJobSystem().ParallelFor(frame.height, [&](int32_t y)
+			{
+				const olc::Pixel* src = tex.data.data() + tex.width * TexelIndex((float(y) + 0.5f) / float(frame.height) * scale.y + offset.y, tex.height);
+				olc::Pixel* dst = frame.pColData + y * frame.width;
+				for (int32_t x = 0; x < frame.width; x++)
+				{
+					olc::Pixel p = src[vColumns[x]];
+					if (bTinted) p = Modulate(p, tint);
+					Blend(dst[x], p);
+				}
+			}, 16);
+		}
+
+		void DrawDecalQuad(const olc::DecalInstance& decal) override
+		{
+			if (decal.decal == nullptr || decal.decal->id <= 0) return;
+			// Back from normalised device coordinates to frame pixels
+			olc::vf2d p[4];
+			for (int i = 0; i < 4; i++)
+			{
+				p[i].x = (decal.pos[i].x + 1.0f) * 0.5f * float(pBackBuffer->width);
+				p[i].y = (1.0f - decal.pos[i].y) * 0.5f * float(pBackBuffer->height);
+			}
+			// GL_QUADS are drawn as the triangles 0-1-2 and 0-2-3
+			DrawTriangle(decal, p, 0, 1, 2, false);
+			DrawTriangle(decal, p, 2, 0, 3, true);
+		}
+
+		uint32_t CreateTexture(const uint32_t width, const uint32_t height) override
+		{
+			vTextures.emplace_back();
+			return uint32_t(vTextures.size() - 1);
+		}
+
+		uint32_t DeleteTexture(const uint32_t id) override
+		{
+			vTextures[id] = Texture();
+			return id;
+		}
+
+		void UpdateTexture(uint32_t id, olc::Sprite* spr) override
+		{
+			Texture& tex = vTextures[id];
+			tex.width = spr->width;
+			tex.height = spr->height;
+			tex.data.assign(spr->GetData(), spr->GetData() + spr->width * spr->height);
+		}
+
+		void ApplyTexture(uint32_t id) override
+		{ nBoundTexture = id; }
+
+		void ClearBuffer(olc::Pixel p, bool bDepth) override
+		{
+			if (!pBackBuffer) return;
+			std::fill(pBackBuffer->pColData, pBackBuffer->pColData + pBackBuffer->width * pBackBuffer->height, p);
+		}
+
+		olc::rcode ReadFrame(olc::Sprite* spr, bool& bBottomUp) override
+		{
+			if (!pBackBuffer) return olc::FAIL;
+			int32_t w = std::min(spr->width, pBackBuffer->width);
+			for (int32_t y = 0; y < std::min(spr->height, pBackBuffer->height); y++)
+				std::copy(pBackBuffer->pColData + y * pBackBuffer->width, pBackBuffer->pColData + y * pBackBuffer->width + w, spr->pColData + y * spr->width);
+			bBottomUp = false;
+			return olc::OK;
+		}
+
+		void UpdateViewport(const olc::vi2d& pos, const olc::vi2d& size) override
+		{
+			if (pBackBuffer && pBackBuffer->width == size.x && pBackBuffer->height == size.y) return;
+			pBackBuffer = std::make_unique<olc::Sprite>(size.x, size.y);
+			pFrontBuffer = std::make_unique<olc::Sprite>(size.x, size.y);
+		}
+	};
+
+	olc::Sprite* PixelGameEngine::GetFrameBuffer()
+	{ return static_cast<olc::Renderer_Software*>(renderer.get())->GetFrameBuffer(); }
+}
+#endif
+// O------------------------------------------------------------------------------O
+// | END RENDERER: Software                                                       |
+// O------------------------------------------------------------------------------O
+
 
 // O------------------------------------------------------------------------------O
 // | START PLATFORM: MICROSOFT WINDOWS XP, VISTA, 7, 8, 10                        |
@@ -2758,7 +3846,7 @@ namespace olc
 		{
 			// Load sprite from input stream
 			ResourceBuffer rb = pack->GetFileBuffer(sImageFile);
-			bmp = Gdiplus::Bitmap::FromStream(SHCreateMemStream((BYTE*)rb.vMemory.data(), UINT(rb.vMemory.size())));
+			bmp = Gdiplus::Bitmap::FromStream(SHCreateMemStream((const BYTE*)rb.pData, UINT(rb.nSize)));
 		}
 		else
 		{
@@ -2795,8 +3883,10 @@ namespace olc
 // | START PLATFORM: LINUX                                                        |
 // O------------------------------------------------------------------------------O
 #if defined(__linux__) || defined(__FreeBSD__)
+#include <png.h>
 namespace olc
 {
+#if !defined(OLC_PLATFORM_HEADLESS)
 	class Platform_Linux : public olc::Platform
 	{
 	private:
@@ -3010,6 +4100,7 @@ namespace olc
 			return olc::OK;
 		}
 	};
+#endif
 
 	void pngReadStream(png_structp pngPtr, png_bytep data, png_size_t length)
 	{
@@ -3035,7 +4126,6 @@ namespace olc
 			png_read_info(png, info);
 			png_byte color_type;
 			png_byte bit_depth;
-			png_bytep* row_pointers;
 			width = png_get_image_width(png, info);
 			height = png_get_image_height(png, info);
 			color_type = png_get_color_type(png, info);
@@ -3052,28 +4142,15 @@ namespace olc
 				color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
 				png_set_gray_to_rgb(png);
 			png_read_update_info(png, info);
-			row_pointers = (png_bytep*)malloc(sizeof(png_bytep) * height);
-			for (int y = 0; y < height; y++) {
-				row_pointers[y] = (png_byte*)malloc(png_get_rowbytes(png, info));
-			}
-			png_read_image(png, row_pointers);
 			////////////////////////////////////////////////////////////////////////////
-			// Create sprite array
+			// Create sprite array, after the transforms above every row is
+			// RGBA like olc::Pixel, so libpng writes straight into it
+			delete[] pColData;
 			pColData = new Pixel[width * height];
-			// Iterate through image rows, converting into sprite format
+			std::vector<png_bytep> row_pointers(height);
 			for (int y = 0; y < height; y++)
-			{
-				png_bytep row = row_pointers[y];
-				for (int x = 0; x < width; x++)
-				{
-					png_bytep px = &(row[x * 4]);
-					SetPixel(x, y, Pixel(px[0], px[1], px[2], px[3]));
-				}
-			}
-
-			for (int y = 0; y < height; y++) // Thanks maksym33
-				free(row_pointers[y]);
-			free(row_pointers);
+				row_pointers[y] = (png_bytep)(pColData + y * width);
+			png_read_image(png, row_pointers.data());
 			png_destroy_read_struct(&png, &info, nullptr);			
 		};
 
@@ -3115,16 +4192,78 @@ namespace olc
 // | END PLATFORM: LINUX                                                          |
 // O------------------------------------------------------------------------------O
 
+
+
+// O------------------------------------------------------------------------------O
+// | START PLATFORM: HEADLESS (no window, no input, for servers and containers)   |
+// O------------------------------------------------------------------------------O
+#if defined(OLC_PLATFORM_HEADLESS)
+namespace olc
+{
+	class Platform_Headless : public olc::Platform
+	{
+	public:
+		virtual olc::rcode ApplicationStartUp() override
+		{ return olc::rcode::OK; }
+
+		virtual olc::rcode ApplicationCleanUp() override
+		{ return olc::rcode::OK; }
+
+		virtual olc::rcode ThreadStartUp() override
+		{ return olc::rcode::OK; }
+
+		virtual olc::rcode ThreadCleanUp() override
+		{
+			renderer->DestroyDevice();
+			return olc::OK;
+		}
+
+		virtual olc::rcode CreateGraphics(bool bFullScreen, bool bEnableVSYNC, const olc::vi2d& vViewPos, const olc::vi2d& vViewSize) override
+		{
+			if (renderer->CreateDevice({}, bFullScreen, bEnableVSYNC) == olc::rcode::OK)
+			{
+				renderer->UpdateViewport(vViewPos, vViewSize);
+				return olc::rcode::OK;
+			}
+			else
+				return olc::rcode::FAIL;
+		}
+
+		virtual olc::rcode CreateWindowPane(const olc::vi2d& vWindowPos, olc::vi2d& vWindowSize, bool bFullScreen) override
+		{ return olc::rcode::OK; }
+
+		virtual olc::rcode SetWindowTitle(const std::string& s) override
+		{ return olc::rcode::OK; }
+
+		// Nothing to wait for, Start() goes straight on to joining the engine
+		// thread, which runs until the application quits
+		virtual olc::rcode StartSystemEventLoop() override
+		{ return olc::rcode::OK; }
+
+		virtual olc::rcode HandleSystemEvent() override
+		{ return olc::rcode::OK; }
+	};
+}
+#endif
+// O------------------------------------------------------------------------------O
+// | END PLATFORM: HEADLESS                                                       |
+// O------------------------------------------------------------------------------O
+
+
 namespace olc
 {
 	void PixelGameEngine::olc_ConfigureSystem()
 	{
-#if defined(_WIN32)
+#if defined(OLC_PLATFORM_HEADLESS)
+		platform = std::make_unique<olc::Platform_Headless>();
+#else
+	#if defined(_WIN32)
 		platform = std::make_unique<olc::Platform_Windows>();
-#endif
+	#endif
 
-#if defined(__linux__) || defined(__FreeBSD__)
+	#if defined(__linux__) || defined(__FreeBSD__)
 		platform = std::make_unique<olc::Platform_Linux>();
+	#endif
 #endif
 
 #if defined(OLC_GFX_OPENGL10)
@@ -3139,6 +4278,10 @@ namespace olc
 		renderer = std::make_unique<olc::Renderer_DX10>();
 #endif
 
+#if defined(OLC_GFX_SOFTWARE)
+		renderer = std::make_unique<olc::Renderer_Software>();
+#endif
+
 		//// Associate components with PGE instance
 		platform->ptrPGE = this;
 		renderer->ptrPGE = this;